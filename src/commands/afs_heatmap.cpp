@@ -30,14 +30,17 @@
 #include "genesis/population/functions/genome_heatmap.hpp"
 #include "genesis/population/functions/heatmap_colorization.hpp"
 #include "genesis/population/functions/variant.hpp"
-#include "genesis/population/functions/variant.hpp"
+#include "genesis/utils/io/input_stream.hpp"
 #include "genesis/utils/math/statistics.hpp"
+#include "genesis/utils/text/convert.hpp"
+#include "genesis/utils/text/string.hpp"
 #include "genesis/utils/tools/color/list_diverging.hpp"
 #include "genesis/utils/tools/color/list_sequential.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <limits>
+#include <memory>
 #include <stdexcept>
 #include <utility>
 
@@ -77,9 +80,25 @@ void setup_afs_heatmap( CLI::App& app )
     // Required input of some frequency format, and settings for the sliding window.
     options->freq_input.add_frequency_input_opts_to_app( sub );
     options->freq_input.add_sample_name_opts_to_app( sub );
-    options->freq_input.add_filter_opts_to_app( sub );
+    // Invariant positions cannot be skipped, as they are part of the spectra.
+    options->freq_input.add_filter_opts_to_app( sub, false );
     options->freq_input.add_sliding_window_opts_to_app( sub );
 
+    // Alternative input of previously computed spectra, to only render the heatmap.
+    options->spectrum_cache_file.option = sub->add_option(
+        "--spectrum-cache-file",
+        options->spectrum_cache_file.value,
+        "Path to a spectrum cache file as written by `--write-spectrum-cache` in a previous run. "
+        "If provided, the input is not parsed again; instead, the heatmap is rendered directly "
+        "from the cached spectra, which is useful to quickly try different colorization settings. "
+        "The `--resolution` can be reduced by any integer divisor of the cached resolution."
+    );
+    options->spectrum_cache_file.option->group( "Input" );
+    options->spectrum_cache_file.option->check( CLI::ExistingFile );
+    options->spectrum_cache_file.option->excludes( "--pileup-file" );
+    options->spectrum_cache_file.option->excludes( "--sync-file" );
+    options->spectrum_cache_file.option->excludes( "--vcf-file" );
+
     // -------------------------------------------------------------------------
     //     Settings
     // -------------------------------------------------------------------------
@@ -107,7 +126,7 @@ void setup_afs_heatmap( CLI::App& app )
     options->max_frequency.option->group( "Settings" );
     options->max_frequency.option->check( CLI::Range( 0.0, 1.0 ) & CLI::PositiveNumber );
 
-    // TODO color, invert vert, log scale, max per column, empty color
+    // TODO invert vert, empty color
 
     // Which type of allele to use
     options->spectrum_type.option = sub->add_option(
@@ -155,7 +174,8 @@ void setup_afs_heatmap( CLI::App& app )
         "Only relevant if `--spectrum-type unfolded` is set. By default, positions with undetermined "
         "reference alleles ('N') are skipped in the unfolded spectrum. If however this option is "
         "set, these positions are instead folded; that is, we then assume the major allele with the "
-        "highest count/frequency to be the reference allele."
+        "highest count/frequency to be the reference allele. Use `--reference-genome` to get "
+        "reference alleles for input files that do not contain them."
     );
     options->fold_undetermined.option->group( "Settings" );
 
@@ -168,6 +188,72 @@ void setup_afs_heatmap( CLI::App& app )
     );
     options->individual_bmps.option->group( "Settings" );
 
+    // Streaming output of individual tiles
+    options->write_tiles.option = sub->add_flag(
+        "--write-tiles",
+        options->write_tiles.value,
+        "If set, instead of the svg heatmap that contains all chromosomes, write one bitmap tile "
+        "per chromosome as soon as the chromosome is processed, and free its memory right away. "
+        "For each tile, a small svg fragment is written that shows the tile with its chromosome "
+        "name, and a lightweight html index page is written that references all tiles. "
+        "This is recommended for large genomes with many chromosomes or scaffolds, or for fine "
+        "window resolutions, where the full svg heatmap becomes too large to handle."
+    );
+    options->write_tiles.option->group( "Settings" );
+    options->write_tiles.option->excludes( options->individual_bmps.option );
+    options->individual_bmps.option->excludes( options->write_tiles.option );
+
+    // -------------------------------------------------------------------------
+    //     Colorization
+    // -------------------------------------------------------------------------
+
+    // Color list to use for the gradient
+    options->color_list.option = sub->add_option(
+        "--color-list",
+        options->color_list.value,
+        "Name of the sequential color list to use for the heatmap gradient."
+    );
+    options->color_list.option->group( "Colorization" );
+    options->color_list.option->transform(
+        CLI::IsMember( genesis::utils::color_list_sequential_names(), CLI::ignore_case )
+    );
+
+    // Log scaling
+    options->linear_scale.option = sub->add_flag(
+        "--linear-scale",
+        options->linear_scale.value,
+        "By default, the counts in the heatmap are colored on a logarithmic scale, which makes "
+        "low frequency bins visible next to the highly populated ones. If set, use a linear "
+        "scale instead."
+    );
+    options->linear_scale.option->group( "Colorization" );
+
+    // Max per column
+    options->max_per_chromosome.option = sub->add_flag(
+        "--max-per-chromosome",
+        options->max_per_chromosome.value,
+        "By default, each column (window) of the heatmap is scaled to its own maximum count, "
+        "so that windows with few positions are still visible. If set, the maximum of the whole "
+        "chromosome is used instead, so that windows can be compared to each other."
+    );
+    options->max_per_chromosome.option->group( "Colorization" );
+
+    // -------------------------------------------------------------------------
+    //     Spectrum Cache
+    // -------------------------------------------------------------------------
+
+    // Write the spectrum cache
+    options->write_spectrum_cache.option = sub->add_flag(
+        "--write-spectrum-cache",
+        options->write_spectrum_cache.value,
+        "If set, additionally write the raw per-window bin counts of the spectra to a "
+        "tab-separated file, which can be provided via `--spectrum-cache-file` in subsequent runs "
+        "to render the heatmap again without having to re-parse the input."
+    );
+    options->write_spectrum_cache.option->group( "Settings" );
+    options->write_spectrum_cache.option->excludes( options->spectrum_cache_file.option );
+    options->spectrum_cache_file.option->excludes( options->write_spectrum_cache.option );
+
     // -------------------------------------------------------------------------
     //     Output
     // -------------------------------------------------------------------------
@@ -176,6 +262,10 @@ void setup_afs_heatmap( CLI::App& app )
     options->file_output.add_default_output_opts_to_app( sub );
     options->file_output.add_file_compress_opt_to_app( sub );
 
+    // The tiles are referenced by the index page, so they cannot be compressed.
+    options->write_tiles.option->excludes( options->file_output.compress_option );
+    options->file_output.compress_option->excludes( options->write_tiles.option );
+
     // Set the run function as callback to be called when this subcommand is issued.
     // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
     sub->callback( grenedalf_cli_callback(
@@ -378,6 +468,335 @@ double compute_frequency_(
     throw std::domain_error( "Internal error: Invalid average frequency method." );
 }
 
+// =================================================================================================
+//      Output Helpers
+// =================================================================================================
+
+/**
+ * @brief Escape the characters of a @p text that have a special meaning in html and svg,
+ * so that chromosome names can be used in the tile index and svg fragments.
+ */
+std::string escape_markup_( std::string const& text )
+{
+    std::string result;
+    result.reserve( text.size() );
+    for( auto const c : text ) {
+        switch( c ) {
+            case '<': result += "&lt;";   break;
+            case '>': result += "&gt;";   break;
+            case '&': result += "&amp;";  break;
+            case '"': result += "&quot;"; break;
+            default:  result += c;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Collection of everything needed to render the spectra of the chromosomes.
+ *
+ * We use this so that spectra that are computed from the input, and spectra that are read from
+ * a spectrum cache file are rendered in the exact same way.
+ */
+struct HeatmapOutput
+{
+    genesis::population::HeatmapColorization colorization;
+    genesis::population::GenomeHeatmap heatmap;
+
+    // In tile mode, we write the index page while going, so that we do not need to keep anything
+    // of the finished chromosomes in memory.
+    std::shared_ptr<genesis::utils::BaseOutputTarget> index_ofs;
+
+    // Resolution of the spectra, which can differ from the user option when downsampling a cache.
+    size_t resolution;
+};
+
+/**
+ * @brief Prepare the colorization and output targets for rendering the heatmap.
+ */
+HeatmapOutput prepare_heatmap_output_( AfsHeatmapOptions const& options, size_t resolution )
+{
+    using namespace genesis::population;
+    using namespace genesis::utils;
+
+    // Set up the colorization as requested by the user.
+    HeatmapOutput output{
+        HeatmapColorization( color_list_sequential( options.color_list.value )),
+        GenomeHeatmap(),
+        nullptr,
+        resolution
+    };
+    output.colorization.log_scale( ! options.linear_scale.value );
+    output.colorization.color_map().mask_color( Color(1,1,1) );
+    output.colorization.color_map().under_color( Color(1,1,1) );
+    output.colorization.max_per_column( ! options.max_per_chromosome.value );
+
+    // The tiles are referenced by their file names relative to the index,
+    // as both are written to the same output directory.
+    if( options.write_tiles.value ) {
+        auto& index_ofs = output.index_ofs;
+        index_ofs = options.file_output.get_output_target( "afs-heatmap-index", "html" );
+        (*index_ofs) << "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n";
+        (*index_ofs) << "<title>grenedalf afs-heatmap</title>\n";
+        (*index_ofs) << "<style>\n";
+        (*index_ofs) << "body { font-family: sans-serif; }\n";
+        (*index_ofs) << "img { image-rendering: pixelated; image-rendering: crisp-edges; ";
+        (*index_ofs) << "border: 1px solid #ccc; }\n";
+        (*index_ofs) << "</style>\n</head>\n<body>\n";
+    }
+    return output;
+}
+
+/**
+ * @brief Render the finished spectrum of a chromosome, depending on the output settings.
+ */
+void add_spectrum_to_heatmap_output_(
+    AfsHeatmapOptions const& options,
+    genesis::population::HeatmapColorization::Spectrum const& spectrum,
+    HeatmapOutput& output
+) {
+    // In tile mode, write the bitmap of the chromosome, an svg fragment that shows the bitmap
+    // with its label, and its entry in the index page, and do not keep its image for the full
+    // svg heatmap.
+    if( options.write_tiles.value ) {
+        auto const tile_name = options.file_output.get_output_filename(
+            "afs-heatmap-" + spectrum.chromosome, "bmp", false
+        );
+        auto const fragment_name = options.file_output.get_output_filename(
+            "afs-heatmap-" + spectrum.chromosome, "svg", false
+        );
+        output.colorization.spectrum_to_bmp_file(
+            spectrum,
+            options.file_output.get_output_target(
+                "afs-heatmap-" + spectrum.chromosome, "bmp"
+            )
+        );
+        auto const name = escape_markup_( spectrum.chromosome );
+        auto const width = spectrum.values.size();
+        auto const height = output.resolution;
+
+        // The svg fragment references the bitmap instead of embedding it, so that it stays small.
+        auto fragment_ofs = options.file_output.get_output_target(
+            "afs-heatmap-" + spectrum.chromosome, "svg"
+        );
+        (*fragment_ofs) << "<svg xmlns=\"http://www.w3.org/2000/svg\" ";
+        (*fragment_ofs) << "xmlns:xlink=\"http://www.w3.org/1999/xlink\" ";
+        (*fragment_ofs) << "width=\"" << width << "\" height=\"" << ( height + 20 ) << "\">\n";
+        (*fragment_ofs) << "<text x=\"0\" y=\"15\" font-family=\"sans-serif\" font-size=\"14\">";
+        (*fragment_ofs) << name << "</text>\n";
+        (*fragment_ofs) << "<image x=\"0\" y=\"20\" width=\"" << width << "\" height=\"" << height;
+        (*fragment_ofs) << "\" preserveAspectRatio=\"none\" style=\"image-rendering: pixelated\" ";
+        (*fragment_ofs) << "xlink:href=\"" << escape_markup_( tile_name ) << "\"/>\n";
+        (*fragment_ofs) << "</svg>\n";
+
+        auto& index_ofs = output.index_ofs;
+        (*index_ofs) << "<h3><a href=\"" << escape_markup_( fragment_name ) << "\">";
+        (*index_ofs) << name << "</a></h3>\n";
+        (*index_ofs) << "<img src=\"" << escape_markup_( tile_name ) << "\" alt=\"" << name;
+        (*index_ofs) << "\" width=\"" << width;
+        (*index_ofs) << "\" height=\"" << height << "\">\n";
+        return;
+    }
+
+    // Add the spectrum to the genome heatmap.
+    output.heatmap.add(
+        spectrum.chromosome, output.colorization.spectrum_to_image( spectrum ).first
+    );
+
+    // Write out individual bitmaps for the chromosome.
+    if( options.individual_bmps.value ) {
+        auto const max_val = output.colorization.spectrum_to_bmp_file(
+            spectrum,
+            options.file_output.get_output_target(
+                "afs-heatmap-" + spectrum.chromosome, "bmp"
+            )
+        );
+        if( max_val != 1.0 ) {
+            LOG_MSG << "Max y-axis value for " << spectrum.chromosome
+                    << " heatmap bmp: " << max_val;
+        }
+    }
+}
+
+/**
+ * @brief Finish the heatmap output, that is, write the svg heatmap or close the tile index.
+ */
+void finish_heatmap_output_( AfsHeatmapOptions const& options, HeatmapOutput& output )
+{
+    if( options.write_tiles.value ) {
+        (*output.index_ofs) << "</body>\n</html>\n";
+    } else {
+        output.heatmap.write( options.file_output.get_output_target( "afs-heatmap", "svg" ));
+    }
+}
+
+// =================================================================================================
+//      Spectrum Cache
+// =================================================================================================
+
+/**
+ * @brief Write one column (window) of a spectrum to the cache file.
+ *
+ * The bins contain counts of positions, so we write them as integers, which keeps the file compact,
+ * and avoids any loss of precision. The columns are separated by tabs, which cannot occur in the
+ * chromosome names of FASTA or VCF files, while for example commas can. We still check the name,
+ * so that we do not write a cache file that cannot be read again.
+ */
+void write_spectrum_cache_column_(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    std::string const& chromosome,
+    std::vector<double> const& column
+) {
+    if(
+        chromosome.find_first_of( "\t\r\n" ) != std::string::npos ||
+        ( ! chromosome.empty() && chromosome[0] == '#' )
+    ) {
+        throw std::runtime_error(
+            "Cannot write chromosome name \"" + chromosome + "\" to the spectrum cache file, "
+            "as it contains tabs or line breaks, or starts with `#`."
+        );
+    }
+
+    auto& os = target->ostream();
+    os << chromosome;
+    for( auto const val : column ) {
+        os << "\t" << static_cast<size_t>( val );
+    }
+    os << "\n";
+}
+
+/**
+ * @brief Read a spectrum cache file, and render all its chromosomes.
+ *
+ * The file is streamed, so that only the spectrum of the current chromosome is kept in memory.
+ * If the user requested a smaller resolution than the one of the cache, adjacent bins are summed up.
+ */
+void render_spectrum_cache_( AfsHeatmapOptions const& options )
+{
+    using namespace genesis::population;
+    using namespace genesis::utils;
+
+    auto const& cache_file = options.spectrum_cache_file.value;
+    auto const cache_error_ = [&]( size_t line_num, std::string const& msg ){
+        return CLI::ValidationError(
+            options.spectrum_cache_file.option->get_name() + "(" + cache_file + ")",
+            "Invalid spectrum cache file at line " + std::to_string( line_num ) + ": " + msg
+        );
+    };
+
+    // Settings of the cache, read from its header, and derived values.
+    size_t cache_resolution = 0;
+    double cache_max_frequency = 0.0;
+    size_t bin_factor = 0;
+    std::unique_ptr<HeatmapOutput> output;
+
+    HeatmapColorization::Spectrum spectrum;
+    size_t line_num = 0;
+    InputStream it( from_file( cache_file ));
+    while( it ) {
+        auto const line = it.get_line();
+        ++line_num;
+        if( line.empty() ) {
+            continue;
+        }
+
+        // Header lines with the settings that were used to compute the cached spectra.
+        if( line[0] == '#' ) {
+            auto const fields = split( line.substr( 1 ), ":" );
+            if( fields.size() != 2 ) {
+                continue;
+            }
+            try {
+                if( trim( fields[0] ) == "resolution" ) {
+                    cache_resolution = convert_from_string<size_t>( trim( fields[1] ));
+                } else if( trim( fields[0] ) == "max-frequency" ) {
+                    cache_max_frequency = convert_from_string<double>( trim( fields[1] ));
+                }
+            } catch( ... ) {
+                throw cache_error_( line_num, "Invalid header line." );
+            }
+            continue;
+        }
+
+        // Before the first data line, check the settings, and prepare the output.
+        if( bin_factor == 0 ) {
+            if( cache_resolution == 0 ) {
+                throw cache_error_( line_num, "Missing resolution in the header." );
+            }
+
+            // Use the cached resolution, unless the user asked for a smaller one.
+            auto const resolution = *options.resolution.option
+                ? options.resolution.value
+                : cache_resolution
+            ;
+            if( resolution > cache_resolution || cache_resolution % resolution != 0 ) {
+                throw CLI::ValidationError(
+                    options.resolution.option->get_name(),
+                    "Resolution " + std::to_string( resolution ) + " is not an integer divisor of "
+                    "the resolution of the spectrum cache file, which is " +
+                    std::to_string( cache_resolution ) + "."
+                );
+            }
+
+            // The frequencies have already been assigned to bins, so we cannot change their range.
+            if(
+                *options.max_frequency.option &&
+                std::abs( options.max_frequency.value - cache_max_frequency ) > 1e-6
+            ) {
+                throw CLI::ValidationError(
+                    options.max_frequency.option->get_name(),
+                    "Cannot change the maximum frequency when rendering from a spectrum cache file, "
+                    "which was computed with a maximum frequency of " +
+                    std::to_string( cache_max_frequency ) + "."
+                );
+            }
+
+            bin_factor = cache_resolution / resolution;
+            output = std::unique_ptr<HeatmapOutput>(
+                new HeatmapOutput( prepare_heatmap_output_( options, resolution ))
+            );
+        }
+        assert( bin_factor > 0 && output );
+        assert( output->resolution * bin_factor == cache_resolution );
+
+        // Data line with the chromosome name and the counts per bin.
+        auto const fields = split( line, "\t", false );
+        if( fields.size() != cache_resolution + 1 ) {
+            throw cache_error_( line_num, "Invalid number of bins." );
+        }
+
+        // Things to do when we start with a new chromosome.
+        if( spectrum.values.empty() || fields[0] != spectrum.chromosome ) {
+            if( ! spectrum.values.empty() ) {
+                add_spectrum_to_heatmap_output_( options, spectrum, *output );
+            }
+            LOG_MSG << "At chromosome " << fields[0];
+            spectrum = HeatmapColorization::Spectrum();
+            spectrum.chromosome = fields[0];
+        }
+
+        // Add the column, summing up adjacent bins if we downsample.
+        spectrum.values.emplace_back( output->resolution, 0.0 );
+        auto& spectrum_column = spectrum.values.back();
+        for( size_t i = 0; i < cache_resolution; ++i ) {
+            try {
+                spectrum_column[ i / bin_factor ] += convert_from_string<double>( fields[ i + 1 ] );
+            } catch( ... ) {
+                throw cache_error_( line_num, "Invalid count value \"" + fields[ i + 1 ] + "\"." );
+            }
+        }
+    }
+
+    // Finish the last chromosome, and write the heatmap.
+    if( bin_factor == 0 ) {
+        throw cache_error_( line_num, "File does not contain any spectra." );
+    }
+    if( ! spectrum.values.empty() ) {
+        add_spectrum_to_heatmap_output_( options, spectrum, *output );
+    }
+    finish_heatmap_output_( options, *output );
+}
+
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -387,10 +806,18 @@ void run_afs_heatmap( AfsHeatmapOptions const& options )
     using namespace genesis::population;
     using namespace genesis::utils;
 
-    options.file_output.check_output_files_nonexistence( "afs-heatmap", "svg" );
-    if( options.individual_bmps.value ) {
+    if( options.write_tiles.value ) {
+        options.file_output.check_output_files_nonexistence( "afs-heatmap-index", "html" );
+        options.file_output.check_output_files_nonexistence( "afs-heatmap-*", "svg" );
+    } else {
+        options.file_output.check_output_files_nonexistence( "afs-heatmap", "svg" );
+    }
+    if( options.individual_bmps.value || options.write_tiles.value ) {
         options.file_output.check_output_files_nonexistence( "afs-heatmap-*", "bmp" );
     }
+    if( options.write_spectrum_cache.value ) {
+        options.file_output.check_output_files_nonexistence( "afs-heatmap-spectra", "csv" );
+    }
 
     // -------------------------------------------------------------------------
     //     Settings
@@ -404,6 +831,12 @@ void run_afs_heatmap( AfsHeatmapOptions const& options )
         );
     }
 
+    // If we are given a spectrum cache, we only need to render it, and are done.
+    if( *options.spectrum_cache_file.option ) {
+        render_spectrum_cache_( options );
+        return;
+    }
+
     // Set the enum values.
     options.spectrum_type_enum  = get_enum_map_value(
         spectrum_type_map, options.spectrum_type.value
@@ -431,18 +864,21 @@ void run_afs_heatmap( AfsHeatmapOptions const& options )
     //     Preparation
     // -------------------------------------------------------------------------
 
-    // TODO
-    auto colorization = HeatmapColorization( color_list_blues() );
-    colorization.log_scale( true );
-    colorization.color_map().mask_color( Color(1,1,1) );
-    colorization.color_map().under_color( Color(1,1,1) );
-    colorization.max_per_column( true );
-
-    GenomeHeatmap heatmap;
+    auto output = prepare_heatmap_output_( options, options.resolution.value );
     HeatmapColorization::Spectrum spectrum;
 
     size_t skipped_nonfinites = 0;
 
+    // If requested, we also write the spectra to a cache file while going. The header contains
+    // the settings needed to interpret the bins when rendering from the cache later.
+    std::shared_ptr<genesis::utils::BaseOutputTarget> cache_ofs;
+    if( options.write_spectrum_cache.value ) {
+        cache_ofs = options.file_output.get_output_target( "afs-heatmap-spectra", "csv" );
+        (*cache_ofs) << "# grenedalf afs-heatmap spectrum cache\n";
+        (*cache_ofs) << "# resolution: " << options.resolution.value << "\n";
+        (*cache_ofs) << "# max-frequency: " << options.max_frequency.value << "\n";
+    }
+
     // -------------------------------------------------------------------------
     //     Run
     // -------------------------------------------------------------------------
@@ -501,31 +937,22 @@ void run_afs_heatmap( AfsHeatmapOptions const& options )
             spectrum_column[ index ] += 1.0;
         }
 
+        // Store the finished column in the cache.
+        if( cache_ofs ) {
+            write_spectrum_cache_column_( cache_ofs, spectrum.chromosome, spectrum_column );
+        }
+
         // Things to do when we finish with a chromosome.
         if( window_it.is_last_window() ) {
-            // Add the spectrum to the genome heatmap.
-            heatmap.add(
-                spectrum.chromosome, colorization.spectrum_to_image( spectrum ).first
-            );
+            add_spectrum_to_heatmap_output_( options, spectrum, output );
 
-            // Write out individual bitmaps for the chromosome.
-            if( options.individual_bmps.value ) {
-                auto const max_val = colorization.spectrum_to_bmp_file(
-                    spectrum,
-                    options.file_output.get_output_target(
-                        "afs-heatmap-" + spectrum.chromosome, "bmp"
-                    )
-                );
-                if( max_val != 1.0 ) {
-                    LOG_MSG << "Max y-axis value for " << spectrum.chromosome
-                            << " heatmap bmp: " << max_val;
-                }
-            }
+            // Free the memory of the spectrum right away.
+            spectrum = HeatmapColorization::Spectrum();
         }
     }
 
     if( skipped_nonfinites > 0 ) {
         LOG_MSG << "Skipped " << skipped_nonfinites << " positions due to low counts.";
     }
-    heatmap.write( options.file_output.get_output_target( "afs-heatmap", "svg" ));
+    finish_heatmap_output_( options, output );
 }
@@ -78,6 +78,16 @@ public:
 
     CliOption<bool> fold_undetermined = false;
     CliOption<bool> individual_bmps = false;
+    CliOption<bool> write_tiles = false;
+
+    // Colorization of the heatmap.
+    CliOption<std::string> color_list = "blues";
+    CliOption<bool> linear_scale = false;
+    CliOption<bool> max_per_chromosome = false;
+
+    // Caching of the spectra, to be able to re-render the heatmap without re-parsing the input.
+    CliOption<bool> write_spectrum_cache = false;
+    CliOption<std::string> spectrum_cache_file = "";
 
     FrequencyInputOptions freq_input;
     FileOutputOptions  file_output;
@@ -0,0 +1,321 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+
+#include "commands/cmh.hpp"
+#include "options/global.hpp"
+#include "options/sample_pairs.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/ordered_batches.hpp"
+#include "tools/text_buffer.hpp"
+
+#include "genesis/population/functions/base_counts.hpp"
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_cmh( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto options = std::make_shared<CmhOptions>();
+    auto sub = app.add_subcommand(
+        "cmh",
+        "Compute p-values of the Cochran-Mantel-Haenszel test for consistent allele frequency "
+        "differences across replicated pairs of samples at each position along the genome, "
+        "following PoPoolation2."
+    );
+
+    // -------------------------------------------------------------------------
+    //     Input
+    // -------------------------------------------------------------------------
+
+    // Required input of some frequency format.
+    options->freq_input.add_frequency_input_opts_to_app( sub );
+    options->freq_input.add_sample_name_opts_to_app( sub );
+    options->freq_input.add_filter_opts_to_app( sub );
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    // Settings: Replicate pairs
+    options->replicate_pairs_file.option = sub->add_option(
+        "--replicate-pairs",
+        options->replicate_pairs_file.value,
+        "File containing tab-separated pairs of sample names (one pair per line), where each "
+        "pair is one replicate of the experiment, for example the base population and the evolved "
+        "population of that replicate. Each pair forms one 2x2 table of the major and minor allele "
+        "counts of the test, which are determined from the summed counts of all samples in the "
+        "pairs at the position."
+    );
+    options->replicate_pairs_file.option->group( "Settings" );
+    options->replicate_pairs_file.option->check( CLI::ExistingFile );
+    options->replicate_pairs_file.option->required();
+
+    // Settings: Omit Empty Positions
+    options->omit_na_positions.option = sub->add_flag(
+        "--omit-na-positions",
+        options->omit_na_positions.value,
+        "Do not output positions where the test is not defined, for example at invariant "
+        "positions, or where all replicates lack coverage."
+    );
+    options->omit_na_positions.option->group( "Settings" );
+
+    // -------------------------------------------------------------------------
+    //     Output
+    // -------------------------------------------------------------------------
+
+    // Add table output options.
+    options->table_output.add_separator_char_opt_to_app( sub );
+    options->table_output.add_na_entry_opt_to_app( sub );
+
+    // Output
+    options->file_output.add_default_output_opts_to_app( sub );
+    options->file_output.add_file_compress_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( grenedalf_cli_callback(
+        sub,
+        {
+            // Citation keys as needed
+            "Kofler2011-PoPoolation2"
+        },
+        [ options ]() {
+            run_cmh( *options );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Result of the Cochran-Mantel-Haenszel test at a position.
+ */
+struct CmhResult
+{
+    double statistic = std::numeric_limits<double>::quiet_NaN();
+    double p_value   = std::numeric_limits<double>::quiet_NaN();
+};
+
+/**
+ * @brief Compute the Cochran-Mantel-Haenszel test with continuity correction over the 2x2 tables
+ * of the @p replicate_pairs at a @p variant.
+ *
+ * The major and minor allele are determined from the summed counts of all samples in
+ * @p used_samples. Each pair of samples then gives one table of major and minor counts. Tables
+ * with fewer than two counts do not contribute. The kernel is a single pass over the tables that
+ * accumulates the deviation of the first cell from its expectation and its variance.
+ * Returns NaN if the test is not defined, e.g., at invariant positions.
+ */
+CmhResult cmh_test_(
+    genesis::population::Variant const& variant,
+    std::vector<std::pair<size_t, size_t>> const& replicate_pairs,
+    std::vector<size_t> const& used_samples
+) {
+    // Find the major and minor allele of the used samples.
+    std::array<size_t, 4> totals = {{ 0, 0, 0, 0 }};
+    for( auto const s : used_samples ) {
+        auto const& sample = variant.samples[s];
+        totals[0] += sample.a_count;
+        totals[1] += sample.c_count;
+        totals[2] += sample.g_count;
+        totals[3] += sample.t_count;
+    }
+    size_t major = ( totals[1] > totals[0] ) ? 1 : 0;
+    size_t minor = 1 - major;
+    for( size_t i = 2; i < 4; ++i ) {
+        if( totals[i] > totals[major] ) {
+            minor = major;
+            major = i;
+        } else if( totals[i] > totals[minor] ) {
+            minor = i;
+        }
+    }
+    CmhResult result;
+    if( totals[minor] == 0 ) {
+        return result;
+    }
+
+    // Get the count of a base in a sample by its index in ACGT order.
+    auto const count_ = []( genesis::population::BaseCounts const& sample, size_t base ){
+        switch( base ) {
+            case 0: return sample.a_count;
+            case 1: return sample.c_count;
+            case 2: return sample.g_count;
+            default: return sample.t_count;
+        }
+    };
+
+    // Accumulate over all tables, with the first sample of a pair as the first row,
+    // and the major allele as the first column.
+    double deviation = 0.0;
+    double variance  = 0.0;
+    for( auto const& pair : replicate_pairs ) {
+        auto const& a = variant.samples[ pair.first ];
+        auto const& b = variant.samples[ pair.second ];
+        auto const a_major = static_cast<double>( count_( a, major ));
+        auto const a_minor = static_cast<double>( count_( a, minor ));
+        auto const b_major = static_cast<double>( count_( b, major ));
+        auto const b_minor = static_cast<double>( count_( b, minor ));
+
+        auto const row_1 = a_major + a_minor;
+        auto const row_2 = b_major + b_minor;
+        auto const col_1 = a_major + b_major;
+        auto const col_2 = a_minor + b_minor;
+        auto const n = row_1 + row_2;
+        if( n < 2.0 ) {
+            continue;
+        }
+        deviation += a_major - row_1 * col_1 / n;
+        variance  += row_1 * row_2 * col_1 * col_2 / ( n * n * ( n - 1.0 ));
+    }
+    if( !( variance > 0.0 )) {
+        return result;
+    }
+
+    // Continuity correction as in R's mantelhaen.test(), and the p-value of the chi-squared
+    // distribution with one degree of freedom.
+    auto const abs_deviation = std::abs( deviation );
+    auto const correction = ( abs_deviation >= 0.5 ) ? 0.5 : 0.0;
+    auto const diff = abs_deviation - correction;
+    result.statistic = diff * diff / variance;
+    result.p_value = std::erfc( std::sqrt( result.statistic / 2.0 ));
+    return result;
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_cmh( CmhOptions const& options )
+{
+    using namespace genesis::population;
+
+    // Output preparation.
+    options.file_output.check_output_files_nonexistence( "cmh", "csv" );
+
+    // -------------------------------------------------------------------------
+    //     Preparation
+    // -------------------------------------------------------------------------
+
+    // Get the replicate pairs as indices into the samples.
+    auto const& sample_names = options.freq_input.sample_names();
+    auto const replicate_pairs = SamplePairsOptions::read_sample_pairs_file(
+        options.replicate_pairs_file.value, sample_names, options.replicate_pairs_file.option
+    );
+    if( replicate_pairs.empty() ) {
+        throw CLI::ValidationError(
+            options.replicate_pairs_file.option->get_name() + "(" +
+            options.replicate_pairs_file.value + ")",
+            "No replicate pairs of samples found in the file."
+        );
+    }
+    LOG_MSG << "Computing the Cochran-Mantel-Haenszel test over " << replicate_pairs.size()
+            << " replicate pair" << ( replicate_pairs.size() > 1 ? "s" : "" ) << " of samples.";
+
+    // Get all sample indices that are part of some pair, for finding the major and minor allele.
+    auto used_flags = std::vector<bool>( sample_names.size(), false );
+    for( auto const& pair : replicate_pairs ) {
+        used_flags[ pair.first ]  = true;
+        used_flags[ pair.second ] = true;
+    }
+    auto used_samples = std::vector<size_t>();
+    for( size_t i = 0; i < used_flags.size(); ++i ) {
+        if( used_flags[i] ) {
+            used_samples.push_back( i );
+        }
+    }
+
+    // Get the table settings.
+    auto const sep_char = options.table_output.get_separator_char();
+    auto const& na_entry = options.table_output.get_na_entry();
+    auto const omit_na = options.omit_na_positions.value;
+
+    // Prepare output file and write header line.
+    auto cmh_ofs = options.file_output.get_output_target( "cmh", "csv" );
+    (*cmh_ofs) << "CHROM" << sep_char << "POS" << sep_char << "CMH" << sep_char << "P_VALUE\n";
+
+    // -------------------------------------------------------------------------
+    //     Main Loop
+    // -------------------------------------------------------------------------
+
+    // Stream through the input in batches, which are tested in parallel, and written in order.
+    // The counters are atomic, as the format function is called from multiple threads.
+    std::atomic<size_t> pos_cnt( 0 );
+    std::atomic<size_t> nan_cnt( 0 );
+    write_ordered_batches<Variant>(
+        options.freq_input.get_iterator(),
+        cmh_ofs->ostream(),
+        [&]( Variant const& variant, std::string& buffer ){
+            internal_check(
+                variant.samples.size() == sample_names.size(),
+                "Inconsistent number of samples in input file."
+            );
+            ++pos_cnt;
+            auto const result = cmh_test_( variant, replicate_pairs, used_samples );
+            auto const valid = std::isfinite( result.p_value );
+            if( ! valid ) {
+                ++nan_cnt;
+                if( omit_na ) {
+                    return;
+                }
+            }
+
+            buffer.append( variant.chromosome );
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, variant.position );
+            buffer.push_back( sep_char );
+            if( valid ) {
+                append_double( buffer, result.statistic );
+                buffer.push_back( sep_char );
+                append_double( buffer, result.p_value );
+            } else {
+                buffer.append( na_entry );
+                buffer.push_back( sep_char );
+                buffer.append( na_entry );
+            }
+            buffer.push_back( '\n' );
+        }
+    );
+
+    // Final user output.
+    size_t const total = pos_cnt;
+    size_t const nans  = nan_cnt;
+    LOG_MSG << "\nProcessed " << total << " position" << ( total != 1 ? "s" : "" )
+            << ", of which " << nans << " position" << ( nans != 1 ? "s" : "" )
+            << " did not have a defined test result.";
+}
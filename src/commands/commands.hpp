@@ -27,10 +27,15 @@
 #include "CLI/CLI.hpp"
 
 #include "commands/afs_heatmap.hpp"
+#include "commands/cmh.hpp"
 #include "commands/diversity.hpp"
+#include "commands/fisher.hpp"
 #include "commands/frequency.hpp"
+#include "commands/frequency_covariance.hpp"
 #include "commands/fst.hpp"
+#include "commands/joint_sfs.hpp"
 #include "commands/simulate.hpp"
+#include "commands/stats.hpp"
 #include "commands/sync_file.hpp"
 
 #include "options/global.hpp"
@@ -54,10 +59,15 @@ inline void setup_commands( CLI::App& app )
 
     // Add module subcommands.
     setup_afs_heatmap( app );
+    setup_cmh( app );
     setup_diversity( app );
+    setup_fisher( app );
     setup_frequency( app );
+    setup_frequency_covariance( app );
     setup_fst( app );
+    setup_joint_sfs( app );
     setup_simulate( app );
+    setup_stats( app );
     setup_sync_file( app );
 
     // Add the global options to each of the above subcommands.
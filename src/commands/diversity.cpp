@@ -24,14 +24,19 @@
 #include "commands/diversity.hpp"
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/genome_mask.hpp"
 #include "tools/misc.hpp"
+#include "tools/reference_genome.hpp"
 
 #include "genesis/population/functions/base_counts.hpp"
 #include "genesis/population/functions/diversity.hpp"
 #include "genesis/population/functions/variant.hpp"
 #include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
+#include <string>
 
 // =================================================================================================
 //      Setup
@@ -55,7 +60,9 @@ void setup_diversity( CLI::App& app )
     // Required input of some frequency format, and settings for the sliding window.
     options->freq_input.add_frequency_input_opts_to_app( sub );
     options->freq_input.add_sample_name_opts_to_app( sub );
-    options->freq_input.add_filter_opts_to_app( sub );
+    // Invariant positions cannot be skipped, as the measures are relative to the covered
+    // positions in each window.
+    options->freq_input.add_filter_opts_to_app( sub, false );
     options->freq_input.add_sliding_window_opts_to_app( sub );
 
     // -------------------------------------------------------------------------
@@ -80,7 +87,10 @@ void setup_diversity( CLI::App& app )
     options->min_allele_count.option = sub->add_option(
         "--min-allele-count",
         options->min_allele_count.value,
-        "Minimum allele count of the minor allele. Used for the identification of SNPs."
+        "Minimum allele count of the minor allele. Used for the identification of SNPs. "
+        "This is a parameter of the PoPoolation diversity estimators, which also enters their "
+        "correction terms. It is applied in addition to, and independently of, "
+        "`--filter-min-allele-count`, which removes low counts already when reading the input."
     )->group( "Settings" );
 
     // Minimum coverage
@@ -88,7 +98,10 @@ void setup_diversity( CLI::App& app )
         "--min-coverage",
         options->min_coverage.value,
         "Minimum coverage of a site. Sites with a lower coverage will not be considered "
-        "for SNP identification and coverage estimation."
+        "for SNP identification and coverage estimation. This is a parameter of the PoPoolation "
+        "diversity estimators, which determines the positions that count towards the coverage "
+        "fraction. It is applied in addition to, and independently of, `--filter-min-coverage`, "
+        "which masks samples already when reading the input."
     )->group( "Settings" );
 
     // Maximum coverage
@@ -96,7 +109,9 @@ void setup_diversity( CLI::App& app )
         "--max-coverage",
         options->max_coverage.value,
         "Maximum coverage used for SNP identification. Coverage in ALL populations has to be lower "
-        "or equal to this threshold, otherwise no SNP will be called."
+        "or equal to this threshold, otherwise no SNP will be called. This is a parameter of the "
+        "PoPoolation diversity estimators, applied in addition to, and independently of, "
+        "`--filter-max-coverage`, which masks samples already when reading the input."
     )->group( "Settings" );
 
     // Minimum coverage fraction
@@ -330,13 +345,14 @@ void run_diversity( DiversityOptions const& options )
     // Format: "2R	19500	0	0.000	na" or "A	1500	101	1.000	1.920886709" for example.
     auto write_popoolation_line_ = [](
         std::shared_ptr<genesis::utils::BaseOutputTarget>& ofs,
-        BaseCountWindow const& window,
+        std::string const& chromosome,
+        size_t anchor_position,
         PoolDiversityResults const& results,
         double value
     ){
         // Write fixed columns.
-        (*ofs) << window.chromosome();
-        (*ofs) << "\t" << window.anchor_position( WindowAnchorType::kIntervalMidpoint );
+        (*ofs) << chromosome;
+        (*ofs) << "\t" << anchor_position;
         (*ofs) << "\t" << results.snp_count;
         (*ofs) << "\t" << std::fixed << std::setprecision( 3 ) << results.coverage_fraction;
         if( std::isfinite( value ) ) {
@@ -347,63 +363,13 @@ void run_diversity( DiversityOptions const& options )
         (*ofs) << "\n";
     };
 
-    // -------------------------------------------------------------------------
-    //     Main Loop
-    // -------------------------------------------------------------------------
-
-    // A bit of user output to keep 'em happy. Chromsomes, windows, positions.
-    size_t chr_cnt = 0;
-    size_t win_cnt = 0;
-    size_t pos_cnt = 0;
-
-    // Iterate the file and compute per-window diversitye measures.
-    // We run the samples in parallel, storing their results before writing to the output file.
-    // For now, we compute all of them, in not the very most efficient way, but the easiest.
-    auto window_it = options.freq_input.get_base_count_sliding_window_iterator();
+    // Write the results of the current window, stored in the per-sample results,
+    // depending on the format.
     auto sample_divs = std::vector<PoolDiversityResults>( sample_names.size() );
-    for( ; window_it; ++window_it ) {
-        auto const& window = *window_it;
-        ++win_cnt;
-        pos_cnt += window.size();
-
-        // Some user output to report progress.
-        if( window_it.is_first_window() ) {
-            LOG_MSG << "At chromosome " << window.chromosome();
-            ++chr_cnt;
-        }
-        LOG_MSG2 << "    At window "
-                 << window.chromosome() << ":"
-                 << window.first_position() << "-"
-                 <<  window.last_position();
-
-        // Skip empty windows if the user wants to.
-        // if( window.empty() && options.omit_empty_windows.value ) {
-        //     continue;
-        // }
-
-        // Compute diversity in parallel over samples.
-        #pragma omp parallel for
-        for( size_t i = 0; i < sample_names.size(); ++i ) {
-
-            // Select sample i within the current window.
-            auto range = make_transform_range(
-                [i]( BaseCountWindow::Entry const& entry ) -> BaseCounts const& {
-                    internal_check(
-                        i < entry.data.size(),
-                        "Inconsistent number of samples in input file."
-                    );
-                    return entry.data[i];
-                },
-                window.begin(), window.end()
-            );
-
-            // Compute diversity measures for the sample. We always compute all measures,
-            // even if not all of them will be written afterwards. It's fast enough anyway,
-            // and most of the compute time is spent in parsing, so that's okay and easier.
-            sample_divs[i] = pool_diversity_measures( pool_settings[i], range.begin(), range.end() );
-        }
-
-        // Write the data, depending on the format.
+    auto write_window_results_ = [&](
+        std::string const& chromosome, size_t first_position, size_t last_position,
+        size_t anchor_position
+    ){
         if( options.popoolation_format.value ) {
 
             // Write to all individual files for each sample and each value.
@@ -412,7 +378,7 @@ void run_diversity( DiversityOptions const& options )
                 if( compute_theta_pi ) {
                     write_popoolation_line_(
                         popoolation_theta_pi_ofss[i],
-                        window,
+                        chromosome, anchor_position,
                         sample_divs[i],
                         sample_divs[i].theta_pi_relative
                     );
@@ -422,7 +388,7 @@ void run_diversity( DiversityOptions const& options )
                 if( compute_theta_wa ) {
                     write_popoolation_line_(
                         popoolation_theta_wa_ofss[i],
-                        window,
+                        chromosome, anchor_position,
                         sample_divs[i],
                         sample_divs[i].theta_watterson_relative
                     );
@@ -432,7 +398,7 @@ void run_diversity( DiversityOptions const& options )
                 if( compute_tajima_d ) {
                     write_popoolation_line_(
                         popoolation_tajima_d_ofss[i],
-                        window,
+                        chromosome, anchor_position,
                         sample_divs[i],
                         sample_divs[i].tajima_d
                     );
@@ -442,9 +408,9 @@ void run_diversity( DiversityOptions const& options )
         } else {
 
             // Write fixed columns.
-            (*table_ofs) << window.chromosome();
-            (*table_ofs) << sep_char << window.first_position();
-            (*table_ofs) << sep_char << window.last_position();
+            (*table_ofs) << chromosome;
+            (*table_ofs) << sep_char << first_position;
+            (*table_ofs) << sep_char << last_position;
 
             // Write the per-pair diversity values in the correct order.
             for( auto const& sample_div : sample_divs ) {
@@ -470,6 +436,161 @@ void run_diversity( DiversityOptions const& options )
             }
             (*table_ofs) << "\n";
         }
+    };
+
+    // Positions that are masked, or that are undetermined (`N`) in the reference genome, or beyond
+    // its chromosome end, cannot be covered, so that we do not count them towards the window width
+    // that is used for the coverage fraction. Chromosomes that are not in the reference genome
+    // only use the mask. Returns the number of callable positions in the window.
+    auto const genome_mask = options.freq_input.get_genome_mask();
+    auto const reference_genome = options.freq_input.get_reference_genome();
+    std::string missing_chromosome;
+    auto set_window_width_ = [&](
+        std::string const& chromosome, size_t first_position, size_t last_position
+    ){
+        size_t width = last_position - first_position + 1;
+        auto const sequence = (
+            reference_genome ? reference_genome->get_sequence( chromosome ) : nullptr
+        );
+        if( reference_genome && ! sequence && missing_chromosome != chromosome ) {
+            LOG_WARN << "Chromosome " << chromosome << " is not in the reference genome. "
+                     << "Its window widths are hence not corrected for undetermined positions.";
+            missing_chromosome = chromosome;
+        }
+        if( sequence ) {
+            auto const mask_bits = genome_mask ? genome_mask->chromosome_bits( chromosome ) : nullptr;
+            width = 0;
+            for( size_t pos = first_position; pos <= last_position; ++pos ) {
+                auto const base = reference_genome->get_base( *sequence, pos );
+                auto const is_acgt = ( base == 'A' || base == 'C' || base == 'G' || base == 'T' );
+                auto const is_masked = mask_bits && GenomeMask::is_masked( *mask_bits, pos );
+                width += static_cast<size_t>( is_acgt && ! is_masked );
+            }
+        } else if( genome_mask ) {
+            auto const masked = genome_mask->masked_count( chromosome, first_position, last_position );
+            width = ( masked < width ? width - masked : 0 );
+        }
+
+        // Windows without any callable positions do not have a coverage fraction. We avoid the
+        // division by zero here, and set their results to n/a after the computation.
+        if( genome_mask || reference_genome ) {
+            for( auto& pool_setting : pool_settings ) {
+                pool_setting.window_width = std::max<size_t>( width, 1 );
+            }
+        }
+        return width;
+    };
+
+    // Set the results of a window without callable positions to n/a.
+    auto set_uncallable_window_results_ = [&](){
+        auto const nan = std::numeric_limits<double>::quiet_NaN();
+        for( auto& sample_div : sample_divs ) {
+            sample_div.theta_pi_absolute        = nan;
+            sample_div.theta_pi_relative        = nan;
+            sample_div.theta_watterson_absolute = nan;
+            sample_div.theta_watterson_relative = nan;
+            sample_div.tajima_d                 = nan;
+            sample_div.coverage_fraction        = 0.0;
+        }
+    };
+
+    // -------------------------------------------------------------------------
+    //     Main Loop
+    // -------------------------------------------------------------------------
+
+    // A bit of user output to keep 'em happy. Chromsomes, windows, positions.
+    size_t chr_cnt = 0;
+    size_t win_cnt = 0;
+    size_t pos_cnt = 0;
+
+    // Iterate the file and compute per-window diversitye measures.
+    // We run the samples in parallel, storing their results before writing to the output file.
+    // For now, we compute all of them, in not the very most efficient way, but the easiest.
+    auto window_it = options.freq_input.get_base_count_sliding_window_iterator();
+    auto const empty_window = std::vector<BaseCounts>();
+    for( ; window_it; ++window_it ) {
+        auto const& window = *window_it;
+        ++win_cnt;
+        pos_cnt += window.size();
+
+        // Some user output to report progress.
+        if( window_it.is_first_window() ) {
+            LOG_MSG << "At chromosome " << window.chromosome();
+            ++chr_cnt;
+        }
+        LOG_MSG2 << "    At window "
+                 << window.chromosome() << ":"
+                 << window.first_position() << "-"
+                 <<  window.last_position();
+
+        // Skip empty windows if the user wants to.
+        // if( window.empty() && options.omit_empty_windows.value ) {
+        //     continue;
+        // }
+
+        // Set the window width that is used for the coverage fraction.
+        auto const callable_width = set_window_width_(
+            window.chromosome(), window.first_position(), window.last_position()
+        );
+
+        // Compute diversity in parallel over samples.
+        #pragma omp parallel for
+        for( size_t i = 0; i < sample_names.size(); ++i ) {
+
+            // Select sample i within the current window.
+            auto range = make_transform_range(
+                [i]( BaseCountWindow::Entry const& entry ) -> BaseCounts const& {
+                    internal_check(
+                        i < entry.data.size(),
+                        "Inconsistent number of samples in input file."
+                    );
+                    return entry.data[i];
+                },
+                window.begin(), window.end()
+            );
+
+            // Compute diversity measures for the sample. We always compute all measures,
+            // even if not all of them will be written afterwards. It's fast enough anyway,
+            // and most of the compute time is spent in parsing, so that's okay and easier.
+            sample_divs[i] = pool_diversity_measures( pool_settings[i], range.begin(), range.end() );
+        }
+        if( callable_width == 0 ) {
+            set_uncallable_window_results_();
+        }
+
+        // Write the data, depending on the format.
+        write_window_results_(
+            window.chromosome(), window.first_position(), window.last_position(),
+            window.anchor_position( WindowAnchorType::kIntervalMidpoint )
+        );
+
+        // If we know the length of the chromosome from the reference genome, we continue with
+        // empty windows after the last window with data, until we reach the chromosome end.
+        // The first of them is the first window in the stride grid that starts after the end of
+        // the last window, so that they do not overlap with positions that had data.
+        if( window_it.is_last_window() && reference_genome ) {
+            auto const chr_len = reference_genome->chromosome_length( window.chromosome() );
+            auto const stride = window_width_and_stride.second;
+            auto const gap = window.last_position() + 1 - window.first_position();
+            auto first = window.first_position() + ( gap + stride - 1 ) / stride * stride;
+            while( first <= chr_len ) {
+                auto const last = first + window_width_and_stride.first - 1;
+                auto const empty_width = set_window_width_( window.chromosome(), first, last );
+                for( size_t i = 0; i < sample_names.size(); ++i ) {
+                    sample_divs[i] = pool_diversity_measures(
+                        pool_settings[i], empty_window.begin(), empty_window.end()
+                    );
+                }
+                if( empty_width == 0 ) {
+                    set_uncallable_window_results_();
+                }
+                write_window_results_(
+                    window.chromosome(), first, last, first + ( last - first ) / 2
+                );
+                ++win_cnt;
+                first += window_width_and_stride.second;
+            }
+        }
     }
 
     LOG_MSG << "\nProcessed " << chr_cnt << " chromosome" << ( chr_cnt != 1 ? "s" : "" )
@@ -0,0 +1,514 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+
+#include "commands/fisher.hpp"
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+
+#include "genesis/population/functions/base_counts.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_fisher( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto options = std::make_shared<FisherOptions>();
+    auto sub = app.add_subcommand(
+        "fisher",
+        "Compute Fisher's exact test for allele frequency differences between pairs of samples "
+        "at each SNP, and summarize the p-values in windows along the genome, following "
+        "PoPoolation2."
+    );
+
+    // -------------------------------------------------------------------------
+    //     Input
+    // -------------------------------------------------------------------------
+
+    // Required input of some frequency format, and settings for the sliding window.
+    options->freq_input.add_frequency_input_opts_to_app( sub );
+    options->freq_input.add_sample_name_opts_to_app( sub );
+    options->freq_input.add_filter_opts_to_app( sub );
+    options->freq_input.add_sliding_window_opts_to_app( sub );
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    // Settings: Window Summary
+    options->window_summary.option = sub->add_option(
+        "--window-summary",
+        options->window_summary.value,
+        "Method to summarize the p-values of the SNPs in a window, as in PoPoolation2: Either "
+        "the product of the p-values, their geometric mean, or their median. The output is the "
+        "`-log10` of the summarized p-value. With `--window-width 1`, all methods yield the "
+        "p-value of the single position."
+    );
+    options->window_summary.option->group( "Settings" );
+    options->window_summary.option->transform(
+        CLI::IsMember({ "multiply", "geometric-mean", "median" }, CLI::ignore_case )
+    );
+
+    // Settings: Omit Empty Windows
+    options->omit_na_windows.option = sub->add_flag(
+        "--omit-na-windows",
+        options->omit_na_windows.value,
+        "Do not output windows where all values are n/a (e.g., without any SNPs). This is "
+        "particularly relevant when choosing `--window-width 1` (or other small window sizes), "
+        "in order to not produce output for invariant positions in the genome."
+    );
+    options->omit_na_windows.option->group( "Settings" );
+
+    // Settings: Comparand
+    options->sample_pairs.add_sample_pairs_opts_to_app( sub, "Fisher's exact test" );
+
+    // -------------------------------------------------------------------------
+    //     Output
+    // -------------------------------------------------------------------------
+
+    // Add table output options.
+    options->table_output.add_separator_char_opt_to_app( sub );
+    options->table_output.add_na_entry_opt_to_app( sub );
+
+    // Output
+    options->file_output.add_default_output_opts_to_app( sub );
+    options->file_output.add_file_compress_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( grenedalf_cli_callback(
+        sub,
+        {
+            // Citation keys as needed
+            "Kofler2011-PoPoolation2"
+        },
+        [ options ]() {
+            run_fisher( *options );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Allele counts of a pair of samples at a position, as a 2x2 contingency table
+ * of the major and minor allele counts of both samples, in the order
+ * `{ a_major, a_minor, b_major, b_minor }`.
+ */
+using FisherTable = std::array<size_t, 4>;
+
+/**
+ * @brief Method to summarize the p-values of the SNPs in a window.
+ */
+enum class WindowSummary
+{
+    kMultiply,
+    kGeometricMean,
+    kMedian
+};
+
+/**
+ * @brief Data of a window that we need for the tests, so that we can process batches of windows
+ * in parallel after the window iterator has moved on.
+ */
+struct FisherWindow
+{
+    std::string chromosome;
+    size_t first_position = 0;
+    size_t last_position  = 0;
+    size_t entry_count    = 0;
+
+    // The tables of the positions that are variable in each pair of samples are stored in one
+    // buffer for the whole batch, grouped by pair. The tables of pair `i` of this window are in
+    // the range `[ table_offsets[i], table_offsets[i+1] )` of that buffer.
+    std::vector<size_t> table_offsets;
+
+    // Per pair of samples, the summarized `-log10` p-value of the tests.
+    std::vector<double> scores;
+};
+
+/**
+ * @brief Fill the @p table with the counts of the two most frequent alleles of the two samples
+ * @p a and @p b at a position.
+ *
+ * The major and minor allele are determined from the combined counts of both samples, as done
+ * by PoPoolation2. Returns `false` for positions that are not variable between the two samples.
+ */
+bool fill_fisher_table_(
+    FisherTable& table,
+    genesis::population::BaseCounts const& a,
+    genesis::population::BaseCounts const& b
+) {
+    std::array<size_t, 4> const a_counts = {{ a.a_count, a.c_count, a.g_count, a.t_count }};
+    std::array<size_t, 4> const b_counts = {{ b.a_count, b.c_count, b.g_count, b.t_count }};
+
+    // Find the major and minor allele of the sum of both samples.
+    size_t major = 0;
+    size_t minor = 1;
+    auto total = [&]( size_t i ){
+        return a_counts[i] + b_counts[i];
+    };
+    if( total( minor ) > total( major )) {
+        std::swap( major, minor );
+    }
+    for( size_t i = 2; i < 4; ++i ) {
+        if( total( i ) > total( major )) {
+            minor = major;
+            major = i;
+        } else if( total( i ) > total( minor )) {
+            minor = i;
+        }
+    }
+    if( total( minor ) == 0 ) {
+        return false;
+    }
+
+    table[0] = a_counts[major];
+    table[1] = a_counts[minor];
+    table[2] = b_counts[major];
+    table[3] = b_counts[minor];
+    return true;
+}
+
+/**
+ * @brief Extend the table of log factorials so that it contains at least `log( n! )`.
+ *
+ * The table is only extended between batches of windows, so that the parallel computation
+ * of the tests can read it without synchronization.
+ */
+void extend_log_factorials_( std::vector<double>& log_factorials, size_t n )
+{
+    if( log_factorials.empty() ) {
+        log_factorials.push_back( 0.0 );
+    }
+    log_factorials.reserve( n + 1 );
+    for( size_t i = log_factorials.size(); i <= n; ++i ) {
+        log_factorials.push_back( log_factorials.back() + std::log( static_cast<double>( i )));
+    }
+}
+
+/**
+ * @brief Compute the natural logarithm of the two-sided p-value of Fisher's exact test for
+ * a 2x2 @p table, using precomputed @p log_factorials that need to cover the sum of the table.
+ *
+ * The p-value is the sum of the probabilities of all tables with the same margins
+ * that are at most as probable as the observed one. We sum relative to the probability of the
+ * observed table, so that small p-values do not underflow. Returns NaN for empty margins.
+ */
+double fisher_exact_log_p_value_(
+    FisherTable const& table, std::vector<double> const& log_factorials
+) {
+    // Margins of the table: row sums of both samples, and the column sum of major alleles.
+    auto const n1 = table[0] + table[1];
+    auto const n2 = table[2] + table[3];
+    auto const c1 = table[0] + table[2];
+    auto const n  = n1 + n2;
+    if( n1 == 0 || n2 == 0 || c1 == 0 || c1 == n ) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    assert( n < log_factorials.size() );
+
+    // Log probability of the table with k major alleles in the first sample,
+    // following the hypergeometric distribution.
+    auto const& lf = log_factorials;
+    auto const log_norm = lf[n1] + lf[n2] + lf[c1] + lf[n - c1] - lf[n];
+    auto log_prob = [&]( size_t k ){
+        return log_norm - lf[k] - lf[n1 - k] - lf[c1 - k] - lf[n2 + k - c1];
+    };
+
+    // Sum up all tables that are at most as probable as the observed one, with some relative
+    // tolerance for rounding, as done in R's fisher.test().
+    auto const k_min = ( c1 > n2 ) ? c1 - n2 : 0;
+    auto const k_max = std::min( n1, c1 );
+    auto const observed = log_prob( table[0] );
+    auto const threshold = observed + 1e-7;
+    double sum = 0.0;
+    for( size_t k = k_min; k <= k_max; ++k ) {
+        auto const lp = log_prob( k );
+        if( lp <= threshold ) {
+            sum += std::exp( lp - observed );
+        }
+    }
+    return std::min( observed + std::log( sum ), 0.0 );
+}
+
+/**
+ * @brief Summarize the `-log10` p-values of the SNPs of a window, given as @p scores,
+ * with the given @p method. Returns NaN if there are no scores.
+ *
+ * The product of the p-values is the sum of the scores, and their geometric mean is the mean
+ * of the scores. As `-log10` is monotonic, the median can also be taken directly on the scores.
+ */
+double summarize_scores_( std::vector<double>& scores, WindowSummary method )
+{
+    if( scores.empty() ) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    switch( method ) {
+        case WindowSummary::kMultiply: {
+            return std::accumulate( scores.begin(), scores.end(), 0.0 );
+        }
+        case WindowSummary::kGeometricMean: {
+            auto const sum = std::accumulate( scores.begin(), scores.end(), 0.0 );
+            return sum / static_cast<double>( scores.size() );
+        }
+        case WindowSummary::kMedian: {
+            auto const mid = scores.size() / 2;
+            std::nth_element( scores.begin(), scores.begin() + mid, scores.end() );
+            auto const upper = scores[ mid ];
+            if( scores.size() % 2 == 1 ) {
+                return upper;
+            }
+            auto const lower = *std::max_element( scores.begin(), scores.begin() + mid );
+            return ( lower + upper ) / 2.0;
+        }
+    }
+
+    // This is called in parallel regions, where we cannot throw.
+    assert( false );
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_fisher( FisherOptions const& options )
+{
+    using namespace genesis::population;
+    using namespace genesis::utils;
+
+    // Output preparation.
+    options.file_output.check_output_files_nonexistence( "fisher", "csv" );
+
+    // -------------------------------------------------------------------------
+    //     Preparation
+    // -------------------------------------------------------------------------
+
+    // Get indices of all pairs of samples for which we want to compute the test.
+    auto const& sample_names = options.freq_input.sample_names();
+    auto const sample_pairs = options.sample_pairs.get_sample_pairs( sample_names );
+    if( sample_pairs.empty() ) {
+        LOG_WARN << "No pairs of samples selected, which will produce empty output. Stopping now.";
+        return;
+    }
+    LOG_MSG << "Computing Fisher's exact test between " << sample_pairs.size()
+            << " pair" << ( sample_pairs.size() > 1 ? "s" : "" ) << " of samples.";
+
+    // Get the method to summarize the p-values of a window.
+    auto const summary_name = to_lower( options.window_summary.value );
+    WindowSummary summary = WindowSummary::kMultiply;
+    if( summary_name == "geometric-mean" ) {
+        summary = WindowSummary::kGeometricMean;
+    } else if( summary_name == "median" ) {
+        summary = WindowSummary::kMedian;
+    }
+
+    // Get the separator char to use for table entries.
+    auto const sep_char = options.table_output.get_separator_char();
+
+    // Prepare output file and write header line with all pairs of samples.
+    auto fisher_ofs = options.file_output.get_output_target( "fisher", "csv" );
+    (*fisher_ofs) << "CHROM" << sep_char << "START" << sep_char << "END" << sep_char << "SNPS";
+    for( auto const& pair : sample_pairs ) {
+        (*fisher_ofs) << sep_char << sample_names[pair.first] << "." << sample_names[pair.second];
+    }
+    (*fisher_ofs) << "\n";
+
+    // -------------------------------------------------------------------------
+    //     Batch Processing
+    // -------------------------------------------------------------------------
+
+    // We collect the contingency tables of a batch of windows, and then run the tests
+    // for all windows and pairs of the batch in parallel. As the number of tables per window
+    // grows with the number of positions and pairs, the batch is limited by the number of
+    // tables as well, so that its memory stays bounded. The log factorials are extended
+    // before each batch to the largest table sum, which is bounded by the coverage of the
+    // two samples at a position.
+    size_t const batch_size = 4096;
+    size_t const batch_table_limit = 1 << 22;
+    auto batch = std::vector<FisherWindow>( batch_size );
+    auto batch_tables = std::vector<FisherTable>();
+    size_t batch_used = 0;
+    auto log_factorials = std::vector<double>();
+
+    size_t win_cnt = 0;
+    size_t nan_cnt = 0;
+    auto process_batch_ = [&](){
+        // Prepare the table of log factorials for the largest table of the batch. This needs
+        // to happen here, as the tests run in a parallel region, where we cannot throw.
+        size_t max_total = 0;
+        for( auto const& table : batch_tables ) {
+            max_total = std::max( max_total, table[0] + table[1] + table[2] + table[3] );
+        }
+        extend_log_factorials_( log_factorials, max_total );
+        internal_check( max_total < log_factorials.size(), "Log factorial table too small." );
+
+        // Compute all tests of the batch in parallel, over windows and pairs at the same time,
+        // and summarize the `-log10` p-values of the SNPs of each window and pair.
+        auto const pair_cnt = sample_pairs.size();
+        auto const task_cnt = batch_used * pair_cnt;
+        #pragma omp parallel for schedule(dynamic, 64)
+        for( size_t t = 0; t < task_cnt; ++t ) {
+            auto& window = batch[ t / pair_cnt ];
+            auto const begin = window.table_offsets[ t % pair_cnt ];
+            auto const end   = window.table_offsets[ t % pair_cnt + 1 ];
+            std::vector<double> scores;
+            scores.reserve( end - begin );
+            for( size_t k = begin; k < end; ++k ) {
+                auto const log_p = fisher_exact_log_p_value_( batch_tables[k], log_factorials );
+                if( std::isfinite( log_p )) {
+                    scores.push_back( std::max( 0.0, -log_p / std::log( 10.0 )));
+                }
+            }
+            window.scores[ t % pair_cnt ] = summarize_scores_( scores, summary );
+        }
+
+        // Write the values in the order of the windows, skipping all-n/a ones if needed.
+        for( size_t w = 0; w < batch_used; ++w ) {
+            auto const& window = batch[w];
+            if(
+                options.omit_na_windows.value &&
+                std::none_of( window.scores.begin(), window.scores.end(), []( double v ) {
+                    return std::isfinite( v );
+                })
+            ) {
+                ++nan_cnt;
+                continue;
+            }
+            ++win_cnt;
+
+            // Write fixed columns.
+            (*fisher_ofs) << window.chromosome;
+            (*fisher_ofs) << sep_char << window.first_position;
+            (*fisher_ofs) << sep_char << window.last_position;
+            (*fisher_ofs) << sep_char << window.entry_count;
+
+            // Write the per-pair summarized values in the correct order.
+            for( auto const& score : window.scores ) {
+                if( std::isfinite( score ) ) {
+                    (*fisher_ofs) << sep_char << score;
+                } else {
+                    (*fisher_ofs) << sep_char << options.table_output.get_na_entry();
+                }
+            }
+            (*fisher_ofs) << "\n";
+        }
+        batch_used = 0;
+        batch_tables.clear();
+    };
+
+    // -------------------------------------------------------------------------
+    //     Main Loop
+    // -------------------------------------------------------------------------
+
+    // Iterate the file and collect the contingency tables of each window.
+    size_t chr_cnt = 0;
+    size_t pos_cnt = 0;
+
+    auto window_it = options.freq_input.get_base_count_sliding_window_iterator();
+    for( ; window_it; ++window_it ) {
+        auto const& window = *window_it;
+        pos_cnt += window.size();
+
+        // Some user output to report progress.
+        if( window_it.is_first_window() ) {
+            LOG_MSG << "At chromosome " << window.chromosome();
+            ++chr_cnt;
+        }
+
+        // Skip empty windows if the user wants to.
+        if( window.empty() && options.omit_na_windows.value ) {
+            ++nan_cnt;
+            continue;
+        }
+
+        LOG_MSG2 << "    At window "
+                 << window.chromosome() << ":"
+                 << window.first_position() << "-"
+                 <<  window.last_position();
+
+        // Fill the next slot of the batch, re-using its memory.
+        // The tables are added pair by pair, so that they are grouped by pair in the buffer.
+        auto& entry = batch[ batch_used ];
+        entry.chromosome     = window.chromosome();
+        entry.first_position = window.first_position();
+        entry.last_position  = window.last_position();
+        entry.entry_count    = window.entry_count();
+        entry.table_offsets.resize( sample_pairs.size() + 1 );
+        entry.scores.resize( sample_pairs.size() );
+        FisherTable table;
+        for( size_t i = 0; i < sample_pairs.size(); ++i ) {
+            entry.table_offsets[i] = batch_tables.size();
+            for( auto const& window_entry : window ) {
+                internal_check(
+                    sample_pairs[i].first  < window_entry.data.size() &&
+                    sample_pairs[i].second < window_entry.data.size(),
+                    "Inconsistent number of samples in input file."
+                );
+                if( fill_fisher_table_(
+                    table,
+                    window_entry.data[ sample_pairs[i].first ],
+                    window_entry.data[ sample_pairs[i].second ]
+                )) {
+                    batch_tables.push_back( table );
+                }
+            }
+        }
+        entry.table_offsets.back() = batch_tables.size();
+
+        // Run the tests once the batch is full, either in windows, or in tables.
+        ++batch_used;
+        if( batch_used == batch_size || batch_tables.size() >= batch_table_limit ) {
+            process_batch_();
+        }
+    }
+    process_batch_();
+
+    // Final user output.
+    LOG_MSG << "\nProcessed " << chr_cnt << " chromosome" << ( chr_cnt != 1 ? "s" : "" )
+            << " with " << pos_cnt << " total position" << ( pos_cnt != 1 ? "s" : "" )
+            << " in " << win_cnt << " window" << ( win_cnt != 1 ? "s" : "" )
+            << " with p-values, and skipped " << nan_cnt << " window"
+            << ( nan_cnt != 1 ? "s" : "" ) << " without any p-values.";
+}
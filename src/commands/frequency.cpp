@@ -24,8 +24,21 @@
 #include "commands/frequency.hpp"
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/frequency_binary.hpp"
+#include "tools/misc.hpp"
+#include "tools/ordered_batches.hpp"
+#include "tools/text_buffer.hpp"
 
 #include "genesis/population/functions/base_counts.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 // =================================================================================================
 //      Setup
@@ -45,6 +58,19 @@ void setup_frequency( CLI::App& app )
     options->freq_input.add_sample_name_opts_to_app( sub );
     options->freq_input.add_filter_opts_to_app( sub );
 
+    // Windowed mode
+    options->window_average.option = sub->add_flag(
+        "--window-average",
+        options->window_average.value,
+        "If set, instead of writing one line per position, aggregate the positions in windows "
+        "along the chromosome, given by the `--window-width` and `--window-stride` settings. "
+        "For each window and sample, the table then contains the number of SNPs (positions where "
+        "the sample has both REF and ALT counts), as well as the mean coverage, the mean frequency "
+        "(of the positions with non-zero coverage), and the sum of REF and ALT counts, "
+        "according to the selected columns."
+    )->group( "Settings" );
+    options->freq_input.add_sliding_window_opts_to_app( sub );
+
     // Which columns to write
     auto write_coverage_opt = sub->add_flag(
         "--write-coverage",
@@ -73,6 +99,23 @@ void setup_frequency( CLI::App& app )
     write_all_opt->excludes( write_freq_opt );
     write_all_opt->excludes( write_counts_opt );
 
+    // Output format
+    options->format.option = sub->add_option(
+        "--format",
+        options->format.value,
+        "Select the output file format. Either a text `table`, or a `binary` columnar file that "
+        "stores the data in chunks of positions, with a column per sample and field, for fast "
+        "loading into downstream tools. The binary file is uncompressed, so that it can be "
+        "memory-mapped, and contains a header with the sample names and fields, as well as "
+        "offsets to each chunk and column, so that only the needed columns have to be read. "
+        "See the wiki page on the binary frequency format for its specification. "
+        "The binary format is not available with `--window-average`."
+    );
+    options->format.option->group( "Settings" );
+    options->format.option->transform(
+        CLI::IsMember({ "table", "binary" }, CLI::ignore_case )
+    );
+
     // Add table output options.
     options->table_output.add_separator_char_opt_to_app( sub );
     options->table_output.add_na_entry_opt_to_app( sub );
@@ -98,11 +141,14 @@ void setup_frequency( CLI::App& app )
 //      Run
 // =================================================================================================
 
-void run_frequency( FrequencyOptions const& options )
+// -------------------------------------------------------------------------
+//     Table Output
+// -------------------------------------------------------------------------
+
+void run_frequency_table_( FrequencyOptions const& options )
 {
     using namespace genesis::population;
 
-    options.file_output.check_output_files_nonexistence( "frequency", "csv" );
     auto freq_ofs = options.file_output.get_output_target( "frequency", "csv" );
 
     // Make the header fields.
@@ -117,11 +163,6 @@ void run_frequency( FrequencyOptions const& options )
         fields.emplace_back( "REF_CNT" );
         fields.emplace_back( "ALT_CNT" );
     }
-    if( fields.empty() ) {
-        LOG_WARN << "Warning: No output columns are selected; the output will hence only contain "
-                 << "the columns CHROM, POS, REF, ALT. Use the --write-... options to select "
-                 << "which additional columns to write.";
-    }
 
     // Get the separator char to use for table entries.
     auto const sep_char = options.table_output.get_separator_char();
@@ -135,35 +176,274 @@ void run_frequency( FrequencyOptions const& options )
     }
     (*freq_ofs) << "\n";
 
-    // Write the table data
-    for( auto const& freq_it : options.freq_input.get_iterator() ) {
-        (*freq_ofs) << freq_it.chromosome;
-        (*freq_ofs) << sep_char << freq_it.position;
-        (*freq_ofs) << sep_char << freq_it.reference_base;
-        (*freq_ofs) << sep_char << freq_it.alternative_base;
+    // Get the settings in local variables, for access in the formatting function.
+    bool const write_coverage  = options.write_coverage  || options.write_all;
+    bool const write_frequency = options.write_frequency || options.write_all;
+    bool const write_counts    = options.write_counts    || options.write_all;
+    auto const& na_entry = options.table_output.get_na_entry();
+
+    // Write the table data. Reading the input is sequential, but we format the lines in parallel,
+    // in batches of positions that are then written in order.
+    write_ordered_batches<Variant>(
+        options.freq_input.get_iterator(),
+        freq_ofs->ostream(),
+        [&]( Variant const& variant, std::string& buffer ){
+            buffer.append( variant.chromosome );
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, variant.position );
+            buffer.push_back( sep_char );
+            buffer.push_back( variant.reference_base );
+            buffer.push_back( sep_char );
+            buffer.push_back( variant.alternative_base );
+
+            for( auto const& sample : variant.samples ) {
+                auto const ref_cnt = get_base_count( sample, variant.reference_base );
+                auto const alt_cnt = get_base_count( sample, variant.alternative_base );
+                auto const cnt_sum = ref_cnt + alt_cnt;
+
+                if( write_coverage ) {
+                    buffer.push_back( sep_char );
+                    append_unsigned( buffer, cnt_sum );
+                }
+                if( write_frequency ) {
+                    buffer.push_back( sep_char );
+                    if( cnt_sum > 0 ) {
+                        auto const freq = static_cast<double>( ref_cnt ) / static_cast<double>( cnt_sum );
+                        append_double( buffer, freq );
+                    } else {
+                        buffer.append( na_entry );
+                    }
+                }
+                if( write_counts ) {
+                    buffer.push_back( sep_char );
+                    append_unsigned( buffer, ref_cnt );
+                    buffer.push_back( sep_char );
+                    append_unsigned( buffer, alt_cnt );
+                }
+            }
+            buffer.push_back( '\n' );
+        }
+    );
+}
+
+// -------------------------------------------------------------------------
+//     Window Average Output
+// -------------------------------------------------------------------------
+
+void run_frequency_window_average_( FrequencyOptions const& options )
+{
+    using namespace genesis::population;
+
+    auto const& sample_names = options.freq_input.sample_names();
+    auto const sample_count = sample_names.size();
+    bool const write_coverage  = options.write_coverage  || options.write_all;
+    bool const write_frequency = options.write_frequency || options.write_all;
+    bool const write_counts    = options.write_counts    || options.write_all;
+
+    // Get the separator char to use for table entries.
+    auto const sep_char = options.table_output.get_separator_char();
+    auto const& na_entry = options.table_output.get_na_entry();
+
+    // Write the csv header line.
+    auto freq_ofs = options.file_output.get_output_target( "frequency", "csv" );
+    (*freq_ofs) << "CHROM" << sep_char << "START" << sep_char << "END" << sep_char << "POS_CNT";
+    for( auto const& sample : sample_names ) {
+        (*freq_ofs) << sep_char << sample << ".SNP_CNT";
+        if( write_coverage ) {
+            (*freq_ofs) << sep_char << sample << ".MEAN_COV";
+        }
+        if( write_frequency ) {
+            (*freq_ofs) << sep_char << sample << ".MEAN_FREQ";
+        }
+        if( write_counts ) {
+            (*freq_ofs) << sep_char << sample << ".REF_CNT";
+            (*freq_ofs) << sep_char << sample << ".ALT_CNT";
+        }
+    }
+    (*freq_ofs) << "\n";
+
+    // Per-sample sums over the positions of a window. We keep them as separate arrays,
+    // so that the per-position accumulation over samples runs over contiguous memory.
+    std::vector<size_t> snp_cnts( sample_count );
+    std::vector<size_t> ref_sums( sample_count );
+    std::vector<size_t> alt_sums( sample_count );
+    std::vector<size_t> freq_cnts( sample_count );
+    std::vector<double> freq_sums( sample_count );
+    std::vector<size_t> ref_cnts( sample_count );
+    std::vector<size_t> alt_cnts( sample_count );
 
-        for( auto const& sample : freq_it.samples ) {
-            auto const ref_cnt = get_base_count( sample, freq_it.reference_base );
-            auto const alt_cnt = get_base_count( sample, freq_it.alternative_base );
-            auto const cnt_sum = ref_cnt + alt_cnt;
+    // We need the ref and alt bases, so we use Variants as window entries, instead of BaseCounts.
+    size_t chr_cnt = 0;
+    size_t win_cnt = 0;
+    size_t pos_cnt = 0;
+    auto window_it = options.freq_input.get_variant_sliding_window_iterator();
+    std::string buffer;
+    for( ; window_it; ++window_it ) {
+        auto const& window = *window_it;
+        ++win_cnt;
 
-            if( options.write_coverage || options.write_all ) {
-                (*freq_ofs) << sep_char << cnt_sum;
+        // Some user output to report progress.
+        if( window_it.is_first_window() ) {
+            LOG_MSG << "At chromosome " << window.chromosome();
+            ++chr_cnt;
+        }
+        LOG_MSG2 << "    At window "
+                 << window.chromosome() << ":"
+                 << window.first_position() << "-"
+                 <<  window.last_position();
+
+        // Reset the sums.
+        std::fill( snp_cnts.begin(),  snp_cnts.end(),  0 );
+        std::fill( ref_sums.begin(),  ref_sums.end(),  0 );
+        std::fill( alt_sums.begin(),  alt_sums.end(),  0 );
+        std::fill( freq_cnts.begin(), freq_cnts.end(), 0 );
+        std::fill( freq_sums.begin(), freq_sums.end(), 0.0 );
+
+        // Accumulate over all positions in the window. We first get the counts of the position,
+        // and then add them up in branch-free loops over the samples.
+        for( auto const& entry : window ) {
+            auto const& variant = entry.data;
+            internal_check(
+                variant.samples.size() == sample_count,
+                "Inconsistent number of samples in input file."
+            );
+            for( size_t i = 0; i < sample_count; ++i ) {
+                ref_cnts[i] = get_base_count( variant.samples[i], variant.reference_base );
+                alt_cnts[i] = get_base_count( variant.samples[i], variant.alternative_base );
+            }
+            for( size_t i = 0; i < sample_count; ++i ) {
+                auto const cnt_sum = ref_cnts[i] + alt_cnts[i];
+                auto const has_cov = static_cast<size_t>( cnt_sum > 0 );
+                ref_sums[i]  += ref_cnts[i];
+                alt_sums[i]  += alt_cnts[i];
+                snp_cnts[i]  += static_cast<size_t>( ref_cnts[i] > 0 && alt_cnts[i] > 0 );
+                freq_cnts[i] += has_cov;
+                freq_sums[i] += has_cov
+                    ? static_cast<double>( ref_cnts[i] ) / static_cast<double>( cnt_sum )
+                    : 0.0
+                ;
+            }
+        }
+
+        // Write the window line.
+        auto const entry_cnt = window.entry_count();
+        pos_cnt += entry_cnt;
+        buffer.clear();
+        buffer.append( window.chromosome() );
+        buffer.push_back( sep_char );
+        append_unsigned( buffer, window.first_position() );
+        buffer.push_back( sep_char );
+        append_unsigned( buffer, window.last_position() );
+        buffer.push_back( sep_char );
+        append_unsigned( buffer, entry_cnt );
+        for( size_t i = 0; i < sample_count; ++i ) {
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, snp_cnts[i] );
+            if( write_coverage ) {
+                buffer.push_back( sep_char );
+                if( entry_cnt > 0 ) {
+                    auto const cov = static_cast<double>( ref_sums[i] + alt_sums[i] );
+                    append_double( buffer, cov / static_cast<double>( entry_cnt ));
+                } else {
+                    buffer.append( na_entry );
+                }
             }
-            if( options.write_frequency || options.write_all ) {
-                if( cnt_sum > 0 ) {
-                    auto const freq = static_cast<double>( ref_cnt ) / static_cast<double>( cnt_sum );
-                    (*freq_ofs) << sep_char << freq;
+            if( write_frequency ) {
+                buffer.push_back( sep_char );
+                if( freq_cnts[i] > 0 ) {
+                    append_double( buffer, freq_sums[i] / static_cast<double>( freq_cnts[i] ));
                 } else {
-                    (*freq_ofs) << sep_char << options.table_output.get_na_entry();
+                    buffer.append( na_entry );
                 }
             }
-            if( options.write_counts || options.write_all ) {
-                (*freq_ofs) << sep_char << ( ref_cnt );
-                (*freq_ofs) << sep_char << ( alt_cnt );
+            if( write_counts ) {
+                buffer.push_back( sep_char );
+                append_unsigned( buffer, ref_sums[i] );
+                buffer.push_back( sep_char );
+                append_unsigned( buffer, alt_sums[i] );
             }
         }
+        buffer.push_back( '\n' );
+        freq_ofs->ostream() << buffer;
+    }
+
+    LOG_MSG << "\nProcessed " << chr_cnt << " chromosome" << ( chr_cnt != 1 ? "s" : "" )
+            << " with " << pos_cnt << " total position" << ( pos_cnt != 1 ? "s" : "" )
+            << " in " << win_cnt << " window" << ( win_cnt != 1 ? "s" : "" );
+    if( options.freq_input.skipped_position_count() > 0 ) {
+        LOG_MSG << "Skipped " << options.freq_input.skipped_position_count()
+                << " positions due to the filter settings, which are not counted in POS_CNT.";
+    }
+}
+
+// -------------------------------------------------------------------------
+//     Binary Output
+// -------------------------------------------------------------------------
+
+void run_frequency_binary_( FrequencyOptions const& options )
+{
+    // The output needs to be uncompressed, so that it can be memory mapped.
+    if( options.file_output.compress() ) {
+        throw CLI::ValidationError(
+            "--compress", "Binary frequency output cannot be compressed."
+        );
+    }
+    auto freq_ofs = options.file_output.get_output_target( "frequency", "bin" );
+
+    // Get the fields that we want to write.
+    std::uint32_t field_flags = 0;
+    if( options.write_coverage || options.write_all ) {
+        field_flags |= kBinaryCoverage;
+    }
+    if( options.write_frequency || options.write_all ) {
+        field_flags |= kBinaryFrequency;
+    }
+    if( options.write_counts || options.write_all ) {
+        field_flags |= kBinaryRefCount | kBinaryAltCount;
+    }
+
+    // Write all positions. The format is described in tools/frequency_binary.hpp.
+    FrequencyBinaryWriter writer(
+        freq_ofs->ostream(), options.freq_input.sample_names(), field_flags
+    );
+    for( auto const& variant : options.freq_input.get_iterator() ) {
+        writer.add( variant );
+    }
+    writer.finish();
+}
+
+// -------------------------------------------------------------------------
+//     Run
+// -------------------------------------------------------------------------
+
+void run_frequency( FrequencyOptions const& options )
+{
+    using namespace genesis::utils;
+
+    // Check the output file for the selected format.
+    auto const binary = ( to_lower( options.format.value ) == "binary" );
+    if( binary && options.window_average.value ) {
+        throw CLI::ValidationError(
+            "--format", "Binary output is not available with --window-average."
+        );
+    }
+    options.file_output.check_output_files_nonexistence( "frequency", binary ? "bin" : "csv" );
+
+    // User warning for the columns.
+    if( !(
+        options.write_coverage || options.write_frequency || options.write_counts ||
+        options.write_all
+    )) {
+        LOG_WARN << "Warning: No output columns are selected; the output will hence only contain "
+                 << "the columns CHROM, POS, REF, ALT. Use the --write-... options to select "
+                 << "which additional columns to write.";
+    }
 
-        (*freq_ofs) << "\n";
+    if( options.window_average.value ) {
+        run_frequency_window_average_( options );
+    } else if( binary ) {
+        run_frequency_binary_( options );
+    } else {
+        run_frequency_table_( options );
     }
 }
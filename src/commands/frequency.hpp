@@ -29,6 +29,7 @@
 #include "options/file_output.hpp"
 #include "options/frequency_input.hpp"
 #include "options/table_output.hpp"
+#include "tools/cli_option.hpp"
 
 #include <string>
 #include <vector>
@@ -45,6 +46,8 @@ public:
     bool write_frequency;
     bool write_counts;
     bool write_all;
+    CliOption<std::string> format = "table";
+    CliOption<bool> window_average = false;
 
     FrequencyInputOptions freq_input;
     TableOutputOptions table_output;
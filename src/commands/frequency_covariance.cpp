@@ -0,0 +1,458 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+
+#include "commands/frequency_covariance.hpp"
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+
+#include "genesis/population/functions/base_counts.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_frequency_covariance( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto options = std::make_shared<FrequencyCovarianceOptions>();
+    auto sub = app.add_subcommand(
+        "frequency-covariance",
+        "Compute the mean absolute allele frequency differences between pairs of samples in "
+        "windows along the genome, and the genome-wide scaled covariance matrix of the allele "
+        "frequencies of all samples, in one pass through the input. The matrix is a moment "
+        "estimate of the scaled covariance matrix Omega of BayPass, computed directly from the "
+        "observed frequencies, without accounting for sampling and sequencing noise."
+    );
+
+    // -------------------------------------------------------------------------
+    //     Input
+    // -------------------------------------------------------------------------
+
+    // Required input of some frequency format, and settings for the sliding window.
+    options->freq_input.add_frequency_input_opts_to_app( sub );
+    options->freq_input.add_sample_name_opts_to_app( sub );
+    options->freq_input.add_filter_opts_to_app( sub );
+    options->freq_input.add_sliding_window_opts_to_app( sub );
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    // Settings: Omit Empty Windows
+    options->omit_na_windows.option = sub->add_flag(
+        "--omit-na-windows",
+        options->omit_na_windows.value,
+        "Do not output windows where all values are n/a (e.g., without any SNPs). This is "
+        "particularly relevant when choosing `--window-width 1` (or other small window sizes), "
+        "in order to not produce output for invariant positions in the genome."
+    );
+    options->omit_na_windows.option->group( "Settings" );
+
+    // Settings: Comparand
+    options->sample_pairs.add_sample_pairs_opts_to_app( sub, "the allele frequency difference" );
+
+    // -------------------------------------------------------------------------
+    //     Output
+    // -------------------------------------------------------------------------
+
+    // Add table output options.
+    options->table_output.add_separator_char_opt_to_app( sub );
+    options->table_output.add_na_entry_opt_to_app( sub );
+
+    // Output
+    options->file_output.add_default_output_opts_to_app( sub );
+    options->file_output.add_file_compress_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( grenedalf_cli_callback(
+        sub,
+        {
+            // Citation keys as needed
+        },
+        [ options ]() {
+            run_frequency_covariance( *options );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Accumulator for the scaled covariance matrix of the allele frequencies of all samples.
+ *
+ * For each position `l`, the major allele frequencies `x_il` of the samples `i` are centered by
+ * their mean `m_l` across samples, and scaled by `sqrt( m_l ( 1 - m_l ))`. The matrix is then
+ * the mean over positions of the products of these values, that is,
+ * `Omega_ij = 1/L sum_l ( x_il - m_l )( x_jl - m_l ) / ( m_l ( 1 - m_l ))`.
+ * This is the moment estimate of the scaled covariance matrix of BayPass (Gautier 2015),
+ * see also Bonhomme et al. (2010), using the observed frequencies as they are.
+ *
+ * Positions are collected in batches, stored per sample, so that the values of a sample are
+ * contiguous. Each batch is then added to the matrix of cross products as a rank-k update, where
+ * each entry is the dot product of the batch values of two samples. The rows of the matrix
+ * are distributed among the threads, so that no partial sums need to be merged.
+ */
+class FrequencyCovarianceAccumulator
+{
+public:
+
+    FrequencyCovarianceAccumulator( size_t sample_count, size_t batch_size = 1024 )
+        : sample_count_( sample_count )
+        , batch_size_( batch_size )
+        , batch_( sample_count * batch_size )
+        , cross_products_( sample_count * sample_count, 0.0 )
+    {}
+
+    /**
+     * @brief Add the @p frequencies of all samples at a position.
+     *
+     * Positions where the mean frequency is 0 or 1 are not informative, and are ignored.
+     */
+    void add( std::vector<double> const& frequencies )
+    {
+        assert( frequencies.size() == sample_count_ );
+        double mean = 0.0;
+        for( auto const freq : frequencies ) {
+            mean += freq;
+        }
+        mean /= static_cast<double>( sample_count_ );
+        auto const variance = mean * ( 1.0 - mean );
+        if( !( variance > 0.0 )) {
+            return;
+        }
+
+        auto const scale = 1.0 / std::sqrt( variance );
+        for( size_t s = 0; s < sample_count_; ++s ) {
+            batch_[ s * batch_size_ + batch_used_ ] = ( frequencies[s] - mean ) * scale;
+        }
+        ++batch_used_;
+        ++count_;
+        if( batch_used_ == batch_size_ ) {
+            flush_();
+        }
+    }
+
+    /**
+     * @brief Number of positions added so far.
+     */
+    size_t count() const
+    {
+        return count_;
+    }
+
+    /**
+     * @brief Get the scaled covariance matrix, in row-major order.
+     *
+     * Returns a matrix of NaN if no positions were added.
+     */
+    std::vector<double> matrix()
+    {
+        flush_();
+        auto result = std::vector<double>(
+            sample_count_ * sample_count_, std::numeric_limits<double>::quiet_NaN()
+        );
+        if( count_ == 0 ) {
+            return result;
+        }
+        auto const n = static_cast<double>( count_ );
+        for( size_t i = 0; i < sample_count_; ++i ) {
+            for( size_t j = i; j < sample_count_; ++j ) {
+                auto const value = cross_products_[ i * sample_count_ + j ] / n;
+                result[ i * sample_count_ + j ] = value;
+                result[ j * sample_count_ + i ] = value;
+            }
+        }
+        return result;
+    }
+
+private:
+
+    /**
+     * @brief Add the current batch to the upper triangle of the cross products.
+     */
+    void flush_()
+    {
+        auto const used = batch_used_;
+        if( used == 0 ) {
+            return;
+        }
+
+        // Later rows have fewer entries in the upper triangle, so we schedule dynamically.
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t i = 0; i < sample_count_; ++i ) {
+            auto const* row_i = &batch_[ i * batch_size_ ];
+            for( size_t j = i; j < sample_count_; ++j ) {
+                auto const* row_j = &batch_[ j * batch_size_ ];
+                double dot = 0.0;
+                for( size_t k = 0; k < used; ++k ) {
+                    dot += row_i[k] * row_j[k];
+                }
+                cross_products_[ i * sample_count_ + j ] += dot;
+            }
+        }
+        batch_used_ = 0;
+    }
+
+    size_t sample_count_;
+    size_t batch_size_;
+    size_t batch_used_ = 0;
+    size_t count_ = 0;
+
+    std::vector<double> batch_;
+    std::vector<double> cross_products_;
+};
+
+/**
+ * @brief Get the frequencies of the major allele of all @p samples at a position,
+ * where the major and minor allele are determined from the summed counts of all samples.
+ *
+ * Samples without coverage of these two alleles get NaN. Returns false if the position
+ * is not variable across the samples, in which case the @p frequencies are not set.
+ */
+bool major_allele_frequencies_(
+    std::vector<genesis::population::BaseCounts> const& samples,
+    std::vector<double>& frequencies
+) {
+    std::array<size_t, 4> totals = {{ 0, 0, 0, 0 }};
+    for( auto const& sample : samples ) {
+        totals[0] += sample.a_count;
+        totals[1] += sample.c_count;
+        totals[2] += sample.g_count;
+        totals[3] += sample.t_count;
+    }
+    size_t major = ( totals[1] > totals[0] ) ? 1 : 0;
+    size_t minor = 1 - major;
+    for( size_t i = 2; i < 4; ++i ) {
+        if( totals[i] > totals[major] ) {
+            minor = major;
+            major = i;
+        } else if( totals[i] > totals[minor] ) {
+            minor = i;
+        }
+    }
+    if( totals[minor] == 0 ) {
+        return false;
+    }
+
+    frequencies.resize( samples.size() );
+    for( size_t s = 0; s < samples.size(); ++s ) {
+        std::array<size_t, 4> const counts = {{
+            samples[s].a_count, samples[s].c_count, samples[s].g_count, samples[s].t_count
+        }};
+        auto const sum = counts[major] + counts[minor];
+        frequencies[s] = ( sum > 0
+            ? static_cast<double>( counts[major] ) / static_cast<double>( sum )
+            : std::numeric_limits<double>::quiet_NaN()
+        );
+    }
+    return true;
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_frequency_covariance( FrequencyCovarianceOptions const& options )
+{
+    using namespace genesis::population;
+
+    // Output preparation.
+    options.file_output.check_output_files_nonexistence(
+        std::vector<std::string>{ "frequency-difference", "frequency-covariance" }, "csv"
+    );
+
+    // -------------------------------------------------------------------------
+    //     Preparation
+    // -------------------------------------------------------------------------
+
+    // Get indices of all pairs of samples for which we want to compute differences.
+    auto const& sample_names = options.freq_input.sample_names();
+    auto const sample_pairs = options.sample_pairs.get_sample_pairs( sample_names );
+    LOG_MSG << "Computing allele frequency differences between " << sample_pairs.size()
+            << " pair" << ( sample_pairs.size() != 1 ? "s" : "" ) << " of samples, and the "
+            << "scaled covariance matrix of " << sample_names.size() << " sample"
+            << ( sample_names.size() != 1 ? "s" : "" ) << ".";
+
+    // Get the separator char to use for table entries.
+    auto const sep_char = options.table_output.get_separator_char();
+
+    // Prepare output file and write header line with all pairs of samples.
+    auto diff_ofs = options.file_output.get_output_target( "frequency-difference", "csv" );
+    (*diff_ofs) << "CHROM" << sep_char << "START" << sep_char << "END" << sep_char << "SNPS";
+    for( auto const& pair : sample_pairs ) {
+        (*diff_ofs) << sep_char << sample_names[pair.first] << "." << sample_names[pair.second];
+    }
+    (*diff_ofs) << "\n";
+
+    // -------------------------------------------------------------------------
+    //     Main Loop
+    // -------------------------------------------------------------------------
+
+    // Iterate the file and compute per-window differences, and accumulate the covariance.
+    size_t chr_cnt = 0;
+    size_t win_cnt = 0;
+    size_t pos_cnt = 0;
+    size_t nan_cnt = 0;
+
+    auto covariance = FrequencyCovarianceAccumulator( sample_names.size() );
+    auto frequencies = std::vector<double>( sample_names.size() );
+    auto diff_sums = std::vector<double>( sample_pairs.size() );
+    auto diff_cnts = std::vector<size_t>( sample_pairs.size() );
+
+    // Windows might overlap, so we keep track of the last position that we added
+    // to the covariance, to use every position only once.
+    size_t last_covariance_position = 0;
+
+    auto window_it = options.freq_input.get_base_count_sliding_window_iterator();
+    for( ; window_it; ++window_it ) {
+        auto const& window = *window_it;
+        pos_cnt += window.size();
+
+        // Some user output to report progress.
+        if( window_it.is_first_window() ) {
+            LOG_MSG << "At chromosome " << window.chromosome();
+            last_covariance_position = 0;
+            ++chr_cnt;
+        }
+
+        LOG_MSG2 << "    At window "
+                 << window.chromosome() << ":"
+                 << window.first_position() << "-"
+                 <<  window.last_position();
+
+        // Accumulate the differences of all pairs over the variable positions of the window,
+        // and add positions where all samples are covered to the covariance.
+        std::fill( diff_sums.begin(), diff_sums.end(), 0.0 );
+        std::fill( diff_cnts.begin(), diff_cnts.end(), 0 );
+        for( auto const& entry : window ) {
+            internal_check(
+                entry.data.size() == sample_names.size(),
+                "Inconsistent number of samples in input file."
+            );
+            if( ! major_allele_frequencies_( entry.data, frequencies )) {
+                continue;
+            }
+            for( size_t i = 0; i < sample_pairs.size(); ++i ) {
+                auto const freq_a = frequencies[ sample_pairs[i].first ];
+                auto const freq_b = frequencies[ sample_pairs[i].second ];
+                if( std::isfinite( freq_a ) && std::isfinite( freq_b )) {
+                    diff_sums[i] += std::abs( freq_a - freq_b );
+                    ++diff_cnts[i];
+                }
+            }
+            if(
+                entry.position > last_covariance_position &&
+                std::all_of( frequencies.begin(), frequencies.end(), []( double v ) {
+                    return std::isfinite( v );
+                })
+            ) {
+                covariance.add( frequencies );
+                last_covariance_position = entry.position;
+            }
+        }
+
+        // Skip windows without any values if the user wants to.
+        if(
+            options.omit_na_windows.value &&
+            std::none_of( diff_cnts.begin(), diff_cnts.end(), []( size_t c ) {
+                return c > 0;
+            })
+        ) {
+            ++nan_cnt;
+            continue;
+        }
+        ++win_cnt;
+
+        // Write fixed columns.
+        (*diff_ofs) << window.chromosome();
+        (*diff_ofs) << sep_char << window.first_position();
+        (*diff_ofs) << sep_char << window.last_position();
+        (*diff_ofs) << sep_char << window.entry_count();
+
+        // Write the per-pair mean differences in the correct order.
+        for( size_t i = 0; i < sample_pairs.size(); ++i ) {
+            if( diff_cnts[i] > 0 ) {
+                (*diff_ofs) << sep_char << ( diff_sums[i] / static_cast<double>( diff_cnts[i] ));
+            } else {
+                (*diff_ofs) << sep_char << options.table_output.get_na_entry();
+            }
+        }
+        (*diff_ofs) << "\n";
+    }
+
+    // -------------------------------------------------------------------------
+    //     Covariance Matrix
+    // -------------------------------------------------------------------------
+
+    // Write the scaled covariance matrix, with sample names as row and column headers.
+    if( covariance.count() == 0 ) {
+        LOG_WARN << "No variable positions covered in all samples were found, "
+                 << "so that the covariance matrix cannot be computed.";
+    }
+    auto const matrix = covariance.matrix();
+    auto cov_ofs = options.file_output.get_output_target( "frequency-covariance", "csv" );
+    (*cov_ofs) << "SAMPLE";
+    for( auto const& name : sample_names ) {
+        (*cov_ofs) << sep_char << name;
+    }
+    (*cov_ofs) << "\n";
+    for( size_t i = 0; i < sample_names.size(); ++i ) {
+        (*cov_ofs) << sample_names[i];
+        for( size_t j = 0; j < sample_names.size(); ++j ) {
+            auto const value = matrix[ i * sample_names.size() + j ];
+            if( std::isfinite( value )) {
+                (*cov_ofs) << sep_char << value;
+            } else {
+                (*cov_ofs) << sep_char << options.table_output.get_na_entry();
+            }
+        }
+        (*cov_ofs) << "\n";
+    }
+
+    // Final user output.
+    LOG_MSG << "\nProcessed " << chr_cnt << " chromosome" << ( chr_cnt != 1 ? "s" : "" )
+            << " with " << pos_cnt << " total position" << ( pos_cnt != 1 ? "s" : "" )
+            << " in " << win_cnt << " window" << ( win_cnt != 1 ? "s" : "" )
+            << ", and skipped " << nan_cnt << " window" << ( nan_cnt != 1 ? "s" : "" )
+            << " without any values. The covariance matrix is based on "
+            << covariance.count() << " position" << ( covariance.count() != 1 ? "s" : "" )
+            << " that are variable and covered in all samples.";
+}
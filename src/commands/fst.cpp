@@ -29,8 +29,6 @@
 #include "genesis/population/functions/base_counts.hpp"
 #include "genesis/population/functions/structure.hpp"
 #include "genesis/utils/containers/transform_iterator.hpp"
-#include "genesis/utils/core/fs.hpp"
-#include "genesis/utils/text/convert.hpp"
 #include "genesis/utils/text/string.hpp"
 
 #include <algorithm>
@@ -99,37 +97,7 @@ void setup_fst( CLI::App& app )
     options->omit_na_windows.option->group( "Settings" );
 
     // Settings: Comparand
-    options->comparand.option = sub->add_option(
-        "--comparand",
-        options->comparand.value,
-        "By default, F_ST between all pairs of samples (that are not filtered) is computed. "
-        "If this option is given a sample name however, only the pairwise F_ST between that "
-        "sample and all others (that are not filtered) is computed."
-    );
-    options->comparand.option->group( "Settings" );
-
-    // Settings: Second comparand
-    options->second_comparand.option = sub->add_option(
-        "--second-comparand",
-        options->second_comparand.value,
-        "If in addition to `--comparand`, this option is also given a (second) sample name, only "
-        "F_ST between those two samples is computed."
-    );
-    options->second_comparand.option->group( "Settings" );
-    options->second_comparand.option->needs( options->comparand.option );
-
-    // Settings: Comparand list
-    options->comparand_list.option = sub->add_option(
-        "--comparand-list",
-        options->comparand_list.value,
-        "By default, F_ST between all pairs of samples is computed. If this option is given a file "
-        "containing tab-separated pairs of sample names (one pair per line) however, only these "
-        "pairwise F_ST values are computed."
-    );
-    options->comparand_list.option->group( "Settings" );
-    options->comparand_list.option->check( CLI::ExistingFile );
-    options->comparand_list.option->excludes( options->comparand.option );
-    options->comparand_list.option->excludes( options->second_comparand.option );
+    options->sample_pairs.add_sample_pairs_opts_to_app( sub, "F_ST" );
 
     // -------------------------------------------------------------------------
     //     Output
@@ -157,74 +125,6 @@ void setup_fst( CLI::App& app )
     ));
 }
 
-// =================================================================================================
-//      Helper Functions
-// =================================================================================================
-
-std::vector<std::pair<size_t, size_t>> get_sample_pairs_( FstOptions const& options )
-{
-    using namespace genesis::utils;
-
-    // Get sample names and map to their index or throw if invalid name is given.
-    auto const& sample_names = options.freq_input.sample_names();
-    auto sample_index = [&]( std::string const& name ) -> size_t {
-        auto it = std::find( sample_names.begin(), sample_names.end(), name );
-        if( it == sample_names.end() ) {
-            throw CLI::ValidationError(
-                "Invalid sample name: \"" + name  + "\" that was not found in the input, "
-                "or was filtered out."
-            );
-        }
-        return static_cast<size_t>( it - sample_names.begin() );
-    };
-
-    // Get all pairs of samples for which we want to compute F_ST.
-    std::vector<std::pair<size_t, size_t>> sample_pairs;
-    if( *options.comparand.option ) {
-        if( *options.second_comparand.option ) {
-            // Only exactly one pair of samples.
-            auto const index_a = sample_index( options.comparand.value );
-            auto const index_b = sample_index( options.second_comparand.value );
-            sample_pairs.emplace_back( index_a, index_b );
-        } else {
-            // One sample against all others.
-            auto const index_a = sample_index( options.comparand.value );
-            for( auto const& sn : sample_names ) {
-                if( sn != options.comparand.value ) {
-                    auto const index_b = sample_index( sn );
-                    sample_pairs.emplace_back( index_a, index_b );
-                }
-            }
-        }
-    } else if( *options.comparand_list.option ) {
-        // Read list of pairs from file.
-        auto const lines = file_read_lines( options.comparand_list.value );
-        for( size_t i = 0; i < lines.size(); ++i ) {
-            auto const& line = lines[i];
-            auto const pair = split( line, "\t", false );
-            if( pair.size() != 2 ) {
-                throw CLI::ValidationError(
-                    options.comparand_list.option->get_name() + "(" +
-                    options.comparand_list.value + ")",
-                    "Invalid line that does not contain two sample names (line " +
-                    std::to_string( i + 1 ) + ")."
-                );
-            }
-            auto const index_a = sample_index( pair[0] );
-            auto const index_b = sample_index( pair[1] );
-            sample_pairs.emplace_back( index_a, index_b );
-        }
-    } else {
-        // All pairs. Build upper triangle list of sample indices.
-        for( size_t i = 0; i < sample_names.size(); ++i ) {
-            for( size_t j = i + 1; j < sample_names.size(); ++j ) {
-                sample_pairs.emplace_back( i, j );
-            }
-        }
-    }
-    return sample_pairs;
-}
-
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -256,7 +156,9 @@ void run_fst( FstOptions const& options )
     );
 
     // Get indices of all pairs of samples for which we want to compute F_ST.
-    auto const sample_pairs = get_sample_pairs_( options );
+    auto const sample_pairs = options.sample_pairs.get_sample_pairs(
+        options.freq_input.sample_names()
+    );
 
     // Get all sample indices that we are actually interested in.
     // We do this so that pool sizes for samples that we ignore anyway do not need to be given.
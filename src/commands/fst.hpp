@@ -29,6 +29,7 @@
 #include "options/file_output.hpp"
 #include "options/frequency_input.hpp"
 #include "options/poolsizes.hpp"
+#include "options/sample_pairs.hpp"
 #include "options/table_output.hpp"
 #include "tools/cli_option.hpp"
 
@@ -48,9 +49,7 @@ public:
 
     CliOption<std::string> method = "conventional";
     CliOption<bool>        omit_na_windows = false;
-    CliOption<std::string> comparand = "";
-    CliOption<std::string> second_comparand = "";
-    CliOption<std::string> comparand_list = "";
+    SamplePairsOptions     sample_pairs;
 
     TableOutputOptions table_output;
     FileOutputOptions  file_output;
@@ -0,0 +1,417 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/joint_sfs.hpp"
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+
+#include "genesis/population/functions/base_counts.hpp"
+#include "genesis/population/functions/variant.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_joint_sfs( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto options = std::make_shared<JointSfsOptions>();
+    auto sub = app.add_subcommand(
+        "joint-sfs",
+        "Compute the joint (two-dimensional) site frequency spectrum for pairs of samples, "
+        "in the format used by dadi and moments."
+    );
+
+    // -------------------------------------------------------------------------
+    //     Input
+    // -------------------------------------------------------------------------
+
+    // Required input of some frequency format.
+    options->freq_input.add_frequency_input_opts_to_app( sub );
+    options->freq_input.add_sample_name_opts_to_app( sub );
+    options->freq_input.add_filter_opts_to_app( sub );
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    // Settings: Pool sizes
+    options->poolsizes.add_poolsizes_opt_to_app( sub );
+
+    // Settings: Comparands
+    options->sample_pairs.add_sample_pairs_opts_to_app( sub, "the joint spectrum" );
+
+    // Settings: Single sample spectra
+    options->write_1d_spectra.option = sub->add_flag(
+        "--write-1d-spectra",
+        options->write_1d_spectra.value,
+        "If set, additionally write the one-dimensional site frequency spectrum of each sample "
+        "that is part of any of the selected pairs, computed in the same pass over the input."
+    );
+    options->write_1d_spectra.option->group( "Settings" );
+
+    // -------------------------------------------------------------------------
+    //     Output
+    // -------------------------------------------------------------------------
+
+    // Output
+    options->file_output.add_default_output_opts_to_app( sub );
+    options->file_output.add_file_compress_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( grenedalf_cli_callback(
+        sub,
+        {
+            // Citation keys as needed
+        },
+        [ options ]() {
+            run_joint_sfs( *options );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Return whether a base is one of `ACGT`, as only those can be used to polarize the spectrum.
+ */
+bool is_acgt_( char c )
+{
+    switch( c ) {
+        case 'a':
+        case 'A':
+        case 'c':
+        case 'C':
+        case 'g':
+        case 'G':
+        case 't':
+        case 'T': {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Get the entry of the spectrum that a sample contributes to at a position.
+ *
+ * Pool sequencing does not give us individual genotypes, so we instead scale the frequency of the
+ * alternative allele to the number of chromosomes in the pool, and round to the nearest count.
+ * If the sample does not have any coverage at the position, `poolsize + 1` is returned,
+ * which is out of range of the spectrum, and indicates that the sample has to be skipped.
+ */
+size_t get_spectrum_entry_(
+    genesis::population::BaseCounts const& sample,
+    char reference_base,
+    char alternative_base,
+    size_t poolsize
+) {
+    using namespace genesis::population;
+
+    auto const ref_cnt = get_base_count( sample, reference_base );
+    auto const alt_cnt = get_base_count( sample, alternative_base );
+    auto const cnt_sum = ref_cnt + alt_cnt;
+    if( cnt_sum == 0 ) {
+        return poolsize + 1;
+    }
+
+    auto const freq = static_cast<double>( alt_cnt ) / static_cast<double>( cnt_sum );
+    auto const entry = static_cast<size_t>( std::round( freq * static_cast<double>( poolsize )));
+    assert( entry <= poolsize );
+    return entry;
+}
+
+/**
+ * @brief Write a spectrum in the file format of dadi and moments.
+ *
+ * The format consists of a line with the dimensions of the spectrum and the sample names,
+ * followed by a line with all entries in row-major order, and a line with the mask. As dadi does
+ * by default, we mask the two corners of the spectrum, which contain the invariant positions.
+ */
+void write_dadi_spectrum_(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    std::vector<size_t> const& dimensions,
+    std::vector<std::string> const& names,
+    std::vector<size_t> const& spectrum
+) {
+    assert( dimensions.size() == names.size() );
+
+    // Header line with the dimensions and the population names.
+    (*target) << "# Site frequency spectrum computed by grenedalf\n";
+    for( auto const& dim : dimensions ) {
+        (*target) << dim << " ";
+    }
+    (*target) << "unfolded";
+    for( auto const& name : names ) {
+        (*target) << " \"" << name << "\"";
+    }
+    (*target) << "\n";
+
+    // Data line.
+    for( size_t i = 0; i < spectrum.size(); ++i ) {
+        (*target) << ( i > 0 ? " " : "" ) << spectrum[i];
+    }
+    (*target) << "\n";
+
+    // Mask line.
+    for( size_t i = 0; i < spectrum.size(); ++i ) {
+        bool const masked = ( i == 0 || i + 1 == spectrum.size() );
+        (*target) << ( i > 0 ? " " : "" ) << ( masked ? "1" : "0" );
+    }
+    (*target) << "\n";
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_joint_sfs( JointSfsOptions const& options )
+{
+    using namespace genesis::population;
+    using namespace genesis::utils;
+
+    // -------------------------------------------------------------------------
+    //     Preparation
+    // -------------------------------------------------------------------------
+
+    // Get the pairs of samples, and all samples that are part of any of them.
+    // We do this so that pool sizes for samples that we ignore anyway do not need to be given.
+    auto const& sample_names = options.freq_input.sample_names();
+    auto const sample_pairs = options.sample_pairs.get_sample_pairs( sample_names );
+    auto used_samples = std::vector<bool>( sample_names.size(), false );
+    for( auto const& sp : sample_pairs ) {
+        used_samples[ sp.first ]  = true;
+        used_samples[ sp.second ] = true;
+    }
+    if( sample_pairs.empty() ) {
+        LOG_WARN << "No pairs of samples selected, which will produce empty output. Stopping now.";
+        return;
+    }
+    auto const pool_sizes = options.poolsizes.get_pool_sizes( sample_names, used_samples );
+    internal_check(
+        pool_sizes.size() == sample_names.size(),
+        "Inconsistent number of samples and number of pool sizes."
+    );
+
+    // Get the output file names, and check them.
+    auto const joint_infix = [&]( std::pair<size_t, size_t> const& pair ){
+        return "joint-sfs-" + sample_names[pair.first] + "-" + sample_names[pair.second];
+    };
+    auto const single_infix = [&]( size_t index ){
+        return "sfs-" + sample_names[index];
+    };
+    std::vector<std::string> infixes;
+    for( auto const& pair : sample_pairs ) {
+        infixes.push_back( joint_infix( pair ));
+    }
+    if( options.write_1d_spectra.value ) {
+        for( size_t i = 0; i < sample_names.size(); ++i ) {
+            if( used_samples[i] ) {
+                infixes.push_back( single_infix( i ));
+            }
+        }
+    }
+    options.file_output.check_output_files_nonexistence( infixes, "fs" );
+
+    LOG_MSG << "Computing joint site frequency spectra between " << sample_pairs.size()
+            << " pair" << ( sample_pairs.size() > 1 ? "s" : "" ) << " of samples.";
+
+    // Each thread accumulates its own spectra, which are merged at the end. This avoids any
+    // synchronization in the main loop, at the cost of some memory per thread.
+    size_t num_threads = 1;
+    #ifdef GENESIS_OPENMP
+        num_threads = static_cast<size_t>( omp_get_max_threads() );
+    #endif
+
+    // Prepare the spectra for each thread. The joint spectra are stored in row-major order,
+    // with the first sample of the pair in the rows. The single sample spectra are only
+    // allocated for the samples that are actually used.
+    auto joint_spectra = std::vector<std::vector<std::vector<size_t>>>( num_threads );
+    auto single_spectra = std::vector<std::vector<std::vector<size_t>>>( num_threads );
+    for( size_t t = 0; t < num_threads; ++t ) {
+        for( auto const& pair : sample_pairs ) {
+            auto const size = ( pool_sizes[pair.first] + 1 ) * ( pool_sizes[pair.second] + 1 );
+            joint_spectra[t].emplace_back( size, 0 );
+        }
+        single_spectra[t].resize( sample_names.size() );
+        if( options.write_1d_spectra.value ) {
+            for( size_t i = 0; i < sample_names.size(); ++i ) {
+                if( used_samples[i] ) {
+                    single_spectra[t][i].resize( pool_sizes[i] + 1, 0 );
+                }
+            }
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    //     Main Loop
+    // -------------------------------------------------------------------------
+
+    // Reading the input is sequential, so we collect the positions in batches,
+    // which are then processed in parallel.
+    size_t const batch_size = 4096;
+    std::vector<Variant> batch;
+    batch.reserve( batch_size );
+
+    // Process the current batch in parallel, and then clear it.
+    auto process_batch_ = [&](){
+        #pragma omp parallel for
+        for( size_t b = 0; b < batch.size(); ++b ) {
+            size_t thread_num = 0;
+            #ifdef GENESIS_OPENMP
+                thread_num = static_cast<size_t>( omp_get_thread_num() );
+            #endif
+            assert( thread_num < num_threads );
+
+            auto const& variant = batch[b];
+            auto const ref = variant.reference_base;
+            auto const alt = variant.alternative_base;
+            assert( variant.samples.size() == sample_names.size() );
+
+            // Add the position to the joint spectrum of each pair,
+            // unless one of the samples does not have any coverage.
+            for( size_t p = 0; p < sample_pairs.size(); ++p ) {
+                auto const index_a = sample_pairs[p].first;
+                auto const index_b = sample_pairs[p].second;
+                auto const entry_a = get_spectrum_entry_(
+                    variant.samples[index_a], ref, alt, pool_sizes[index_a]
+                );
+                auto const entry_b = get_spectrum_entry_(
+                    variant.samples[index_b], ref, alt, pool_sizes[index_b]
+                );
+                if( entry_a > pool_sizes[index_a] || entry_b > pool_sizes[index_b] ) {
+                    continue;
+                }
+                auto& spectrum = joint_spectra[thread_num][p];
+                auto const index = entry_a * ( pool_sizes[index_b] + 1 ) + entry_b;
+                assert( index < spectrum.size() );
+                ++spectrum[ index ];
+            }
+
+            // Add the position to the single sample spectra.
+            if( options.write_1d_spectra.value ) {
+                for( size_t i = 0; i < sample_names.size(); ++i ) {
+                    if( ! used_samples[i] ) {
+                        continue;
+                    }
+                    auto const entry = get_spectrum_entry_(
+                        variant.samples[i], ref, alt, pool_sizes[i]
+                    );
+                    if( entry <= pool_sizes[i] ) {
+                        ++single_spectra[thread_num][i][entry];
+                    }
+                }
+            }
+        }
+        batch.clear();
+    };
+
+    // Iterate the input, and collect the positions that can be polarized.
+    size_t pos_cnt = 0;
+    size_t skip_cnt = 0;
+    for( auto const& variant : options.freq_input.get_iterator() ) {
+        // Check the input here, as exceptions cannot leave the parallel region.
+        internal_check(
+            variant.samples.size() == sample_names.size(),
+            "Inconsistent number of samples in input file."
+        );
+        if( ! is_acgt_( variant.reference_base ) || ! is_acgt_( variant.alternative_base )) {
+            ++skip_cnt;
+            continue;
+        }
+
+        ++pos_cnt;
+        batch.push_back( variant );
+        if( batch.size() == batch_size ) {
+            process_batch_();
+        }
+    }
+    process_batch_();
+
+    // Merge the per-thread spectra into the first one.
+    for( size_t t = 1; t < num_threads; ++t ) {
+        for( size_t p = 0; p < sample_pairs.size(); ++p ) {
+            auto& target = joint_spectra[0][p];
+            auto const& source = joint_spectra[t][p];
+            assert( target.size() == source.size() );
+            for( size_t i = 0; i < target.size(); ++i ) {
+                target[i] += source[i];
+            }
+        }
+        for( size_t s = 0; s < sample_names.size(); ++s ) {
+            auto& target = single_spectra[0][s];
+            auto const& source = single_spectra[t][s];
+            assert( target.size() == source.size() );
+            for( size_t i = 0; i < target.size(); ++i ) {
+                target[i] += source[i];
+            }
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    //     Output
+    // -------------------------------------------------------------------------
+
+    for( size_t p = 0; p < sample_pairs.size(); ++p ) {
+        auto const index_a = sample_pairs[p].first;
+        auto const index_b = sample_pairs[p].second;
+        write_dadi_spectrum_(
+            options.file_output.get_output_target( joint_infix( sample_pairs[p] ), "fs" ),
+            { pool_sizes[index_a] + 1, pool_sizes[index_b] + 1 },
+            { sample_names[index_a], sample_names[index_b] },
+            joint_spectra[0][p]
+        );
+    }
+    if( options.write_1d_spectra.value ) {
+        for( size_t i = 0; i < sample_names.size(); ++i ) {
+            if( ! used_samples[i] ) {
+                continue;
+            }
+            write_dadi_spectrum_(
+                options.file_output.get_output_target( single_infix( i ), "fs" ),
+                { pool_sizes[i] + 1 },
+                { sample_names[i] },
+                single_spectra[0][i]
+            );
+        }
+    }
+
+    // Final user output.
+    LOG_MSG << "\nProcessed " << pos_cnt << " position" << ( pos_cnt != 1 ? "s" : "" )
+            << ", and skipped " << skip_cnt << " position" << ( skip_cnt != 1 ? "s" : "" )
+            << " without valid reference and alternative bases.";
+}
@@ -24,6 +24,9 @@
 #include "commands/simulate.hpp"
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/random.hpp"
+#include "tools/text_buffer.hpp"
 
 #include "genesis/population/functions/base_counts.hpp"
 #include "genesis/population/functions/variant.hpp"
@@ -35,11 +38,48 @@
 #include <array>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <random>
 #include <stdexcept>
-#include <unordered_set>
 #include <utility>
 
+// =================================================================================================
+//      Enum Mapping
+// =================================================================================================
+
+/**
+ * @brief Models for drawing the coverage of each sample at each position.
+ */
+enum class CoverageModel
+{
+    kUniform,
+    kPoisson,
+    kNegativeBinomial
+};
+
+std::vector<std::pair<std::string, CoverageModel>> const coverage_model_map = {
+    { "uniform",           CoverageModel::kUniform },
+    { "poisson",           CoverageModel::kPoisson },
+    { "negative-binomial", CoverageModel::kNegativeBinomial }
+};
+
+/**
+ * @brief Models for drawing the allele frequencies of the samples at mutated positions.
+ */
+enum class FrequencyModel
+{
+    kUniform,
+    kBaldingNichols,
+    kWrightFisher
+};
+
+std::vector<std::pair<std::string, FrequencyModel>> const frequency_model_map = {
+    { "uniform",         FrequencyModel::kUniform },
+    { "balding-nichols", FrequencyModel::kBaldingNichols },
+    { "wright-fisher",   FrequencyModel::kWrightFisher }
+};
+
 // =================================================================================================
 //      Setup
 // =================================================================================================
@@ -57,11 +97,17 @@ void setup_simulate( CLI::App& app )
     options->format.option = sub->add_option(
         "--format",
         options->format.value,
-        "Select the output file format, either (m)pileup, or PoPollation2 sync."
+        "Select the output file format, either (m)pileup, PoPollation2 sync, or VCF. "
+        "For VCF, the simulated counts are stored in the `AD` (allelic depth) field of each "
+        "sample. As grenedalf only reads biallelic SNPs from VCF, each line has the simulated "
+        "second allele as the alternative, also for invariant positions, so that all formats "
+        "yield the same positions and counts when read. Counts of the other two bases, which "
+        "can occur due to `--sequencing-errors`, are hence not stored in VCF. "
+        "Use `--compress` to get a gzipped VCF file."
     );
     options->format.option->group( "Settings" );
     options->format.option->transform(
-        CLI::IsMember({ "pileup", "sync" }, CLI::ignore_case )
+        CLI::IsMember({ "pileup", "sync", "vcf" }, CLI::ignore_case )
     );
 
     // Random Seed
@@ -69,6 +115,7 @@ void setup_simulate( CLI::App& app )
         "--random-seed",
         options->random_seed.value,
         "Set the random seed for generating values, which allows reproducible results. "
+        "For a given seed, the output is identical independently of the number of `--threads`. "
         "If not provided, the system clock is used to obtain a random seed."
     );
     options->random_seed.option->group( "Settings" );
@@ -93,7 +140,7 @@ void setup_simulate( CLI::App& app )
         "--chromosome",
         options->chromosome.value,
         "Name of the chromosome. This is simply used as the first column in the output file. "
-        "At the moment, only one chromosome is supported."
+        "Use `--chromosome-lengths` instead to simulate multiple chromosomes."
     );
     options->chromosome.option->group( "Genome" );
 
@@ -128,7 +175,21 @@ void setup_simulate( CLI::App& app )
         "Total length of the chromosome to simulate. Mutations are spread across this length."
     );
     options->length.option->group( "Genome" );
-    options->length.option->required();
+
+    // Multiple chromosomes
+    options->chromosome_lengths.option = sub->add_option(
+        "--chromosome-lengths",
+        options->chromosome_lengths.value,
+        "Names and lengths of multiple chromosomes to simulate, as a comma- or tab-separated list "
+        "of `name:length` entries, for example `chr1:1000000,chr2:500000`. "
+        "This replaces `--chromosome` and `--length`. Mutations are spread across the total "
+        "length of all chromosomes, and the `--mutation-rate` is applied to that total length."
+    );
+    options->chromosome_lengths.option->group( "Genome" );
+    options->chromosome_lengths.option->excludes( options->chromosome.option );
+    options->chromosome_lengths.option->excludes( options->length.option );
+    options->chromosome.option->excludes( options->chromosome_lengths.option );
+    options->length.option->excludes( options->chromosome_lengths.option );
 
     // Omit non mutated positions
     options->omit_invariant_positions.option = sub->add_flag(
@@ -139,6 +200,108 @@ void setup_simulate( CLI::App& app )
     );
     options->omit_invariant_positions.option->group( "Genome" );
 
+    // Frequency Model
+    options->frequency_model.option = sub->add_option(
+        "--frequency-model",
+        options->frequency_model.value,
+        "Model for drawing the allele frequencies of the samples at mutated positions. "
+        "With `uniform`, each sample gets an independent frequency, so that there is no population "
+        "structure. The other models first draw an ancestral frequency uniformly, and then derive "
+        "correlated frequencies for the samples, which are treated as populations (demes) here: "
+        "With `balding-nichols`, the frequencies are drawn from a Beta distribution around the "
+        "ancestral frequency, with the given `--fst` between the samples and the ancestor. "
+        "With `wright-fisher`, each sample undergoes independent genetic drift for "
+        "`--wright-fisher-generations` generations, with `--wright-fisher-population-size` "
+        "diploid individuals."
+    );
+    options->frequency_model.option->group( "Population" );
+    options->frequency_model.option->transform(
+        CLI::IsMember( enum_map_keys( frequency_model_map ), CLI::ignore_case )
+    );
+
+    // F_ST
+    options->fst.option = sub->add_option(
+        "--fst",
+        options->fst.value,
+        "F_ST between the samples and their ancestral population, for the `balding-nichols` "
+        "frequency model. Needs to be in the open interval (0, 1)."
+    );
+    options->fst.option->group( "Population" );
+    options->fst.option->check( CLI::Range( 0.0, 1.0 ) & CLI::PositiveNumber );
+
+    // Wright-Fisher generations
+    options->wright_fisher_generations.option = sub->add_option(
+        "--wright-fisher-generations",
+        options->wright_fisher_generations.value,
+        "Number of generations of drift for the `wright-fisher` frequency model. The expected F_ST "
+        "between the samples and their ancestral population is 1 - (1 - 1/2N)^t, for population "
+        "size N and t generations."
+    );
+    options->wright_fisher_generations.option->group( "Population" );
+
+    // Wright-Fisher population size
+    options->wright_fisher_population_size.option = sub->add_option(
+        "--wright-fisher-population-size",
+        options->wright_fisher_population_size.value,
+        "Number of diploid individuals in each population for the `wright-fisher` frequency model."
+    );
+    options->wright_fisher_population_size.option->group( "Population" );
+    options->wright_fisher_population_size.option->check( CLI::PositiveNumber );
+
+    // Coverage Model
+    options->coverage_model.option = sub->add_option(
+        "--coverage-model",
+        options->coverage_model.value,
+        "Model for drawing the coverage of each sample at each position. With `uniform`, the "
+        "coverages are drawn uniformly between the min/max values given in `--coverages` per "
+        "sample. With `poisson` or `negative-binomial`, the `--coverages` instead need to be "
+        "single numbers per sample, which are used as the mean coverage of the distribution. "
+        "The negative binomial distribution is useful to simulate overdispersed coverages, "
+        "as typically seen in real data."
+    );
+    options->coverage_model.option->group( "Samples" );
+    options->coverage_model.option->transform(
+        CLI::IsMember( enum_map_keys( coverage_model_map ), CLI::ignore_case )
+    );
+
+    // Coverage Dispersion
+    options->coverage_dispersion.option = sub->add_option(
+        "--coverage-dispersion",
+        options->coverage_dispersion.value,
+        "Dispersion (size) parameter of the `negative-binomial` coverage model. With mean coverage "
+        "m and dispersion r, the variance of the coverage is m + m^2 / r, so that smaller values "
+        "yield more variable coverages."
+    );
+    options->coverage_dispersion.option->group( "Samples" );
+    options->coverage_dispersion.option->check( CLI::PositiveNumber );
+
+    // Sample Reads
+    options->sample_reads.option = sub->add_flag(
+        "--sample-reads",
+        options->sample_reads.value,
+        "By default, the coverage of each sample is split between the two alleles exactly "
+        "according to the simulated allele frequency. If set, the reads are instead drawn "
+        "binomially from the allele frequency, which introduces realistic sampling noise. "
+        "If additionally `--pool-sizes` are provided, the pool of individuals is first drawn "
+        "binomially from the allele frequency, and the reads are then drawn from the pool."
+    );
+    options->sample_reads.option->group( "Sampling" );
+
+    // Pool Sizes
+    options->poolsizes.add_poolsizes_opt_to_app( sub, false, "Sampling" );
+
+    // Sequencing Errors
+    options->sequencing_errors.option = sub->add_flag(
+        "--sequencing-errors",
+        options->sequencing_errors.value,
+        "If set, simulate sequencing errors, where each read shows one of the other three bases "
+        "with the error probability given by its phred score, using the `--min-phred-score` and "
+        "`--max-phred-score` settings. When writing (m)pileup files with quality scores, "
+        "each read uses its own score, otherwise, the average error probability of the range "
+        "of phred scores is used."
+    );
+    options->sequencing_errors.option->group( "Sampling" );
+
     // With Quality Scores
     options->with_quality_scores.option = sub->add_flag(
         "--with-quality-scores",
@@ -152,7 +315,8 @@ void setup_simulate( CLI::App& app )
     options->min_phred_score.option = sub->add_option(
         "--min-phred-score",
         options->min_phred_score.value,
-        "Minimum phred score to use when simulating an (m)pileup file. Ignored otherwise."
+        "Minimum phred score to use when simulating an (m)pileup file, "
+        "or when simulating `--sequencing-errors`. Ignored otherwise."
     );
     options->min_phred_score.option->group( "Pileup" );
     options->min_phred_score.option->check(
@@ -163,7 +327,8 @@ void setup_simulate( CLI::App& app )
     options->max_phred_score.option = sub->add_option(
         "--max-phred-score",
         options->max_phred_score.value,
-        "Maximum phred score to use when simulating an (m)pileup file. Ignored otherwise."
+        "Maximum phred score to use when simulating an (m)pileup file, "
+        "or when simulating `--sequencing-errors`. Ignored otherwise."
     );
     options->max_phred_score.option->group( "Pileup" );
     options->max_phred_score.option->check(
@@ -197,7 +362,8 @@ void setup_simulate( CLI::App& app )
 enum class SimulateFormat
 {
     kPileup,
-    kSync
+    kSync,
+    kVcf
 };
 
 SimulateFormat get_format( SimulateOptions const& options )
@@ -208,6 +374,8 @@ SimulateFormat get_format( SimulateOptions const& options )
         return SimulateFormat::kPileup;
     } else if( to_lower( options.format.value ) == "sync" ) {
         return SimulateFormat::kSync;
+    } else if( to_lower( options.format.value ) == "vcf" ) {
+        return SimulateFormat::kVcf;
     } else {
         throw std::runtime_error( "Internal error: Invalid format " + options.format.value );
     }
@@ -248,6 +416,50 @@ std::vector<std::pair<size_t,size_t>> get_coverages_( SimulateOptions const& opt
     return result;
 }
 
+/**
+ * @brief Get the chromosomes to simulate, with their names and lengths.
+ */
+std::vector<std::pair<std::string, size_t>> get_chromosomes_( SimulateOptions const& options )
+{
+    using namespace genesis::utils;
+
+    // Simple case of a single chromosome.
+    std::vector<std::pair<std::string, size_t>> result;
+    if( ! *options.chromosome_lengths.option ) {
+        if( ! *options.length.option || options.length.value == 0 ) {
+            throw CLI::ValidationError(
+                "Either " + options.length.option->get_name() + " or " +
+                options.chromosome_lengths.option->get_name() + " have to be provided."
+            );
+        }
+        result.emplace_back( options.chromosome.value, options.length.value );
+        return result;
+    }
+
+    // Multiple chromosomes, as a list of name:length entries.
+    for( auto const& entry : split( options.chromosome_lengths.value, ",\t" )) {
+        auto const name_len = split( trim( entry ), ":" );
+        size_t length = 0;
+        try {
+            if( name_len.size() != 2 ) {
+                throw std::runtime_error( "Invalid chromosome entry." );
+            }
+            length = convert_from_string<size_t>( trim( name_len[1] ));
+        } catch(...) {
+            length = 0;
+        }
+        if( length == 0 || trim( name_len[0] ).empty() ) {
+            throw CLI::ValidationError(
+                options.chromosome_lengths.option->get_name(),
+                "Invalid chromosome entry \"" + entry + "\", which needs to be of the form "
+                "`name:length`, with a non-empty name and a positive length."
+            );
+        }
+        result.emplace_back( trim( name_len[0] ), length );
+    }
+    return result;
+}
+
 /**
  * @brief Turn a number from the distributions into a nucleotide.
  */
@@ -266,6 +478,586 @@ char allele_to_char_( size_t a )
     }
 }
 
+/**
+ * @brief Draw a given number of distinct positions out of a given range, in increasing order.
+ *
+ * This is sequential random sampling without replacement, following Jeffrey Scott Vitter,
+ * "An efficient algorithm for sequential random sampling", ACM Transactions on Mathematical
+ * Software, 1987. Instead of drawing positions and rejecting duplicates, the algorithm draws the
+ * number of positions to skip until the next selected one, so that the positions are produced in
+ * order, in constant memory, and with exactly the requested number of positions in total.
+ * We use Method D while the sample is sparse enough for it to be efficient, and Method A otherwise.
+ */
+class SequentialPositionSampler
+{
+public:
+
+    /**
+     * @brief Prepare to draw @p count positions out of the range `[first, first + length)`.
+     */
+    SequentialPositionSampler( size_t count, size_t length, size_t first = 1 )
+        : remaining_count_( count )
+        , remaining_length_( length )
+        , next_position_( first )
+    {
+        if( count > length ) {
+            throw std::invalid_argument(
+                "Cannot sample more positions than the length of the range."
+            );
+        }
+    }
+
+    /**
+     * @brief Return whether there are positions left to be drawn.
+     */
+    explicit operator bool() const
+    {
+        return remaining_count_ > 0;
+    }
+
+    /**
+     * @brief Draw the next position.
+     */
+    template<class Engine>
+    size_t next( Engine& engine )
+    {
+        assert( remaining_count_ > 0 );
+        assert( remaining_count_ <= remaining_length_ );
+
+        // Get the number of positions to skip, using the method that is suitable.
+        size_t skip = 0;
+        if( remaining_count_ == 1 ) {
+            // Method D leaves a uniform value for the last position, otherwise we draw one.
+            auto const u = vprime_valid_ ? vprime_ : uniform_( engine );
+            skip = static_cast<size_t>( static_cast<double>( remaining_length_ ) * u );
+            skip = std::min( skip, remaining_length_ - 1 );
+        } else if( alpha_inv_ * remaining_count_ < remaining_length_ ) {
+            skip = skip_method_d_( engine );
+        } else {
+            vprime_valid_ = false;
+            skip = skip_method_a_( engine );
+        }
+        assert( skip < remaining_length_ );
+
+        // Select the position after the skipped ones, and move on.
+        auto const result = next_position_ + skip;
+        next_position_ = result + 1;
+        remaining_length_ -= skip + 1;
+        --remaining_count_;
+        return result;
+    }
+
+private:
+
+    /**
+     * @brief Uniform random value in `(0, 1]`, so that we can safely take its logarithm.
+     */
+    template<class Engine>
+    double uniform_( Engine& engine ) const
+    {
+        std::uniform_real_distribution<double> distrib( 0.0, 1.0 );
+        return 1.0 - distrib( engine );
+    }
+
+    /**
+     * @brief Method A, which is linear in the skip length, and efficient for dense samples.
+     */
+    template<class Engine>
+    size_t skip_method_a_( Engine& engine ) const
+    {
+        auto top = static_cast<double>( remaining_length_ - remaining_count_ );
+        auto len = static_cast<double>( remaining_length_ );
+        auto const v = uniform_( engine );
+        auto quot = top / len;
+        size_t skip = 0;
+        while( quot > v ) {
+            ++skip;
+            top -= 1.0;
+            len -= 1.0;
+            quot *= top / len;
+        }
+        return skip;
+    }
+
+    /**
+     * @brief Method D, which draws the skip length in expected constant time via rejection
+     * sampling, and is efficient for sparse samples. Needs at least two remaining positions to draw.
+     */
+    template<class Engine>
+    size_t skip_method_d_( Engine& engine )
+    {
+        assert( remaining_count_ > 1 );
+        auto const n = static_cast<double>( remaining_count_ );
+        auto const len = static_cast<double>( remaining_length_ );
+        auto const ninv = 1.0 / n;
+        auto const nmin1inv = 1.0 / ( n - 1.0 );
+        auto const qu1 = remaining_length_ - remaining_count_ + 1;
+        auto const qu1real = static_cast<double>( qu1 );
+
+        // The value of vprime is carried over between draws, as the algorithm prepares it
+        // for the next sample size when accepting a draw.
+        if( ! vprime_valid_ ) {
+            vprime_ = std::exp( std::log( uniform_( engine )) * ninv );
+            vprime_valid_ = true;
+        }
+
+        size_t skip = 0;
+        while( true ) {
+
+            // Step D2: Generate a candidate skip length from the continuous approximation.
+            double x = 0.0;
+            while( true ) {
+                x = len * ( 1.0 - vprime_ );
+                skip = static_cast<size_t>( x );
+                if( skip < qu1 ) {
+                    break;
+                }
+                vprime_ = std::exp( std::log( uniform_( engine )) * ninv );
+            }
+            auto const u = uniform_( engine );
+            auto const neg_skip = -static_cast<double>( skip );
+
+            // Step D3: Quick acceptance test with the squeeze function.
+            auto const y1 = std::exp( std::log( u * len / qu1real ) * nmin1inv );
+            vprime_ = y1 * ( 1.0 - x / len ) * ( qu1real / ( neg_skip + qu1real ));
+            if( vprime_ <= 1.0 ) {
+                break;
+            }
+
+            // Step D4: Full acceptance test.
+            double y2 = 1.0;
+            double top = len - 1.0;
+            double bottom;
+            size_t limit;
+            if( remaining_count_ - 1 > skip ) {
+                bottom = len - n;
+                limit = remaining_length_ - skip;
+            } else {
+                bottom = len + neg_skip - 1.0;
+                limit = qu1;
+            }
+            for( size_t t = remaining_length_ - 1; t >= limit; --t ) {
+                y2 = ( y2 * top ) / bottom;
+                top -= 1.0;
+                bottom -= 1.0;
+            }
+            if( len / ( len - x ) >= y1 * std::exp( std::log( y2 ) * nmin1inv )) {
+                vprime_ = std::exp( std::log( uniform_( engine )) * nmin1inv );
+                break;
+            }
+            vprime_ = std::exp( std::log( uniform_( engine )) * ninv );
+        }
+        return skip;
+    }
+
+private:
+
+    // Vitter recommends this ratio of range length to sample size to switch to Method A.
+    static constexpr size_t alpha_inv_ = 13;
+
+    size_t remaining_count_;
+    size_t remaining_length_;
+    size_t next_position_;
+
+    double vprime_ = 0.0;
+    bool vprime_valid_ = false;
+};
+
+// =================================================================================================
+//      Simulation Settings
+// =================================================================================================
+
+/**
+ * @brief Settings that are derived from the options once, and are then used for all blocks.
+ */
+struct SimulateSettings
+{
+    SimulateFormat format;
+    CoverageModel coverage_model;
+    FrequencyModel frequency_model;
+
+    // Per sample coverages, as min/max for the uniform model, and as mean otherwise.
+    std::vector<std::pair<size_t,size_t>> sample_coverages;
+
+    // Per sample pool sizes, or empty if the reads are drawn directly from the allele frequency.
+    std::vector<size_t> pool_sizes;
+
+    // Sequencing error probability per phred score, and its average across the range of scores.
+    std::vector<double> error_probabilities;
+    double mean_error_probability = 0.0;
+
+    // Chromosomes with their lengths, in the order in which they are simulated.
+    std::vector<std::pair<std::string, size_t>> chromosomes;
+};
+
+// =================================================================================================
+//      VCF Output
+// =================================================================================================
+
+/**
+ * @brief Write the header of a VCF file, with the chromosomes and the sample names.
+ *
+ * The samples do not have names, so we use their numbers, as we do when reading files without
+ * sample names.
+ */
+void write_vcf_header_(
+    SimulateSettings const& settings,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+) {
+    (*target) << "##fileformat=VCFv4.2\n";
+    (*target) << "##source=grenedalf simulate\n";
+    for( auto const& chromosome : settings.chromosomes ) {
+        (*target) << "##contig=<ID=" << chromosome.first << ",length=" << chromosome.second << ">\n";
+    }
+    (*target) << "##FORMAT=<ID=AD,Number=R,Type=Integer,Description=\"Allelic depths for the ref ";
+    (*target) << "and alt alleles in the order listed\">\n";
+    (*target) << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+    for( size_t i = 0; i < settings.sample_coverages.size(); ++i ) {
+        (*target) << "\t" << ( i + 1 );
+    }
+    (*target) << "\n";
+}
+
+/**
+ * @brief Append a VCF line for a position, given the counts of all samples.
+ *
+ * The line is always biallelic, with the simulated second allele as the alternative, also for
+ * invariant positions, as grenedalf only reads biallelic SNPs from VCF files. That way, reading
+ * the VCF file yields the same positions and reference and alternative counts as the other
+ * formats. Counts of the other two bases (from sequencing errors) are not stored.
+ */
+void append_vcf_line_(
+    std::string& buffer,
+    std::string const& chromosome,
+    size_t position,
+    size_t ref_allele,
+    size_t alt_allele,
+    std::vector<std::array<size_t, 6>> const& sample_counts
+) {
+    assert( ref_allele != alt_allele );
+
+    // Fixed columns. We do not simulate ids, qualities, or filters.
+    buffer.append( chromosome );
+    buffer.push_back( '\t' );
+    append_unsigned( buffer, position );
+    buffer.append( "\t.\t" );
+    buffer.push_back( allele_to_char_( ref_allele ));
+    buffer.push_back( '\t' );
+    buffer.push_back( allele_to_char_( alt_allele ));
+    buffer.append( "\t.\t.\t.\tAD" );
+
+    // Allelic depths per sample, reference first.
+    for( auto const& counts : sample_counts ) {
+        buffer.push_back( '\t' );
+        append_unsigned( buffer, counts[ ref_allele ] );
+        buffer.push_back( ',' );
+        append_unsigned( buffer, counts[ alt_allele ] );
+    }
+}
+
+// =================================================================================================
+//      Block Simulation
+// =================================================================================================
+
+/**
+ * @brief A block of consecutive positions of a chromosome that is simulated as one unit of work.
+ */
+struct SimulateBlock
+{
+    size_t index = 0;
+    size_t chromosome_index = 0;
+    size_t first_position = 0;
+    size_t last_position = 0;
+
+    // Mutated positions within the block, in increasing order.
+    std::vector<size_t> mutations;
+
+    // Formatted output of the block.
+    std::string buffer;
+};
+
+/**
+ * @brief Simulate all positions of a block, and store the formatted output in its buffer.
+ *
+ * The random values are drawn from the stream of the block, so that the result only depends on
+ * the seed and the block index, and blocks can be simulated in parallel and in any order.
+ */
+void simulate_block_(
+    SimulateOptions const& options,
+    SimulateSettings const& settings,
+    std::uint64_t seed,
+    SimulateBlock& block
+) {
+    using namespace genesis::sequence;
+
+    // Stream 0 is used for drawing the mutated positions, so we start the blocks at 1.
+    PhiloxEngine engine( seed, block.index + 1 );
+    auto const& chromosome = settings.chromosomes[ block.chromosome_index ].first;
+    auto const sample_count = settings.sample_coverages.size();
+
+    // Prepare distributions for allele identities, allele frequencies, and phred scores.
+    std::uniform_int_distribution<size_t> first_allele_distrib( 0, 3 );
+    std::uniform_int_distribution<size_t> second_allele_distrib( 1, 3 );
+    std::uniform_real_distribution<double> allele_freq_distrib( 0.0, 1.0 );
+    std::uniform_int_distribution<unsigned char> phred_scores_distrib(
+        options.min_phred_score.value,
+        options.max_phred_score.value
+    );
+
+    // Prepare distributions for per sample coverages. For the uniform model, each sample has its
+    // own range, while for the other models, we set the parameters for each draw.
+    std::vector<std::uniform_int_distribution<size_t>> sample_coverage_distribs;
+    for( auto const& coverage : settings.sample_coverages ) {
+        sample_coverage_distribs.emplace_back( coverage.first, coverage.second );
+    }
+    std::poisson_distribution<size_t> poisson_distrib;
+    std::gamma_distribution<double> gamma_distrib;
+    using poisson_param = std::poisson_distribution<size_t>::param_type;
+    using gamma_param = std::gamma_distribution<double>::param_type;
+
+    // Draw the coverage of a sample.
+    auto draw_coverage_ = [&]( size_t sample ) -> size_t {
+        auto const mean = static_cast<double>( settings.sample_coverages[sample].first );
+        switch( settings.coverage_model ) {
+            case CoverageModel::kUniform: {
+                return sample_coverage_distribs[sample]( engine );
+            }
+            case CoverageModel::kPoisson: {
+                return poisson_distrib( engine, poisson_param( mean ));
+            }
+            case CoverageModel::kNegativeBinomial: {
+                // We use the Gamma-Poisson mixture, which allows non-integer dispersion values.
+                auto const disp = options.coverage_dispersion.value;
+                auto const lambda = gamma_distrib( engine, gamma_param( disp, mean / disp ));
+                return lambda > 0.0 ? poisson_distrib( engine, poisson_param( lambda )) : 0;
+            }
+        }
+        throw std::domain_error( "Internal error: Invalid coverage model." );
+    };
+
+    // Draw from a binomial distribution, re-using the distribution object, and catching the
+    // trivial cases, which are frequent here (invariant positions), without drawing at all.
+    std::binomial_distribution<size_t> binomial_distrib;
+    using binomial_param = std::binomial_distribution<size_t>::param_type;
+    auto draw_binomial_ = [&]( size_t n, double p ) -> size_t {
+        if( n == 0 || p <= 0.0 ) {
+            return 0;
+        }
+        if( p >= 1.0 ) {
+            return n;
+        }
+        return binomial_distrib( engine, binomial_param( n, p ));
+    };
+
+    // Draw the major allele frequency of a sample at a mutated position, given the ancestral
+    // frequency, which is only used by the models with population structure.
+    auto draw_frequency_ = [&]( double ancestral ) -> double {
+        switch( settings.frequency_model ) {
+            case FrequencyModel::kUniform: {
+                return allele_freq_distrib( engine );
+            }
+            case FrequencyModel::kBaldingNichols: {
+                // Beta distribution, drawn via two Gamma distributions.
+                auto const fst = options.fst.value;
+                auto const shape_a = ancestral * ( 1.0 - fst ) / fst;
+                auto const shape_b = ( 1.0 - ancestral ) * ( 1.0 - fst ) / fst;
+                auto const x = gamma_distrib( engine, gamma_param( shape_a, 1.0 ));
+                auto const y = gamma_distrib( engine, gamma_param( shape_b, 1.0 ));
+                return ( x + y > 0.0 ) ? x / ( x + y ) : ancestral;
+            }
+            case FrequencyModel::kWrightFisher: {
+                // Binomial drift of the allele in each generation. Once the allele is lost or
+                // fixed, the binomial draws are trivial, so this is fast for strong drift.
+                auto const chromosomes = 2 * options.wright_fisher_population_size.value;
+                auto frequency = ancestral;
+                for( size_t g = 0; g < options.wright_fisher_generations.value; ++g ) {
+                    frequency = static_cast<double>( draw_binomial_( chromosomes, frequency ))
+                              / static_cast<double>( chromosomes );
+                }
+                return frequency;
+            }
+        }
+        throw std::domain_error( "Internal error: Invalid frequency model." );
+    };
+
+    // Turn some of the reads of an allele into sequencing errors, distributed evenly
+    // among the other three bases. We use the original counts to draw the number of errors,
+    // so that errors are not counted twice.
+    auto add_sequencing_errors_ = [&](
+        std::array<size_t, 6> const& true_counts, std::array<size_t, 6>& counts, size_t allele
+    ) {
+        auto const errors = draw_binomial_( true_counts[allele], settings.mean_error_probability );
+        auto const err_1 = draw_binomial_( errors, 1.0 / 3.0 );
+        auto const err_2 = draw_binomial_( errors - err_1, 0.5 );
+        assert( counts[allele] >= errors );
+        counts[ allele ] -= errors;
+        counts[( allele + 1 ) % 4 ] += err_1;
+        counts[( allele + 2 ) % 4 ] += err_2;
+        counts[( allele + 3 ) % 4 ] += errors - err_1 - err_2;
+    };
+
+    // Simulate a single position, and append it to the buffer of the block. We directly write
+    // into the buffer, which keeps its capacity between waves, and avoid any stream overhead.
+    // The quality scores are collected in a separate buffer, as they come after the bases.
+    auto& buffer = block.buffer;
+    buffer.clear();
+    std::string qualities;
+    auto vcf_counts = std::vector<std::array<size_t, 6>>( sample_count );
+    auto simulate_position_ = [&]( size_t position, bool is_mutation ){
+
+        // Draw two alleles (we are only doing biallelic for now).
+        // The second is drawn so that it differes from the first one.
+        // It might not be used if this is an invariant position. We draw it anyway.
+        auto const a1 = first_allele_distrib( engine );
+        auto const a2 = ( a1 + second_allele_distrib( engine ) ) % 4;
+
+        // Write fixed columns: chromosome, position, referece base. Same for pileup and sync.
+        // For VCF, we first need the counts of all samples to know the alternative alleles,
+        // so that is written after simulating the samples.
+        if( settings.format != SimulateFormat::kVcf ) {
+            buffer.append( chromosome );
+            buffer.push_back( '\t' );
+            append_unsigned( buffer, position );
+            buffer.push_back( '\t' );
+            buffer.push_back( allele_to_char_( a1 ));
+        }
+
+        // For the models with population structure, all samples share an ancestral frequency.
+        // It has to be in the open interval (0, 1), as the Beta distribution of Balding-Nichols
+        // needs positive shapes, so we draw again in the (very rare) case of exactly zero.
+        double ancestral = 0.0;
+        if( is_mutation && settings.frequency_model != FrequencyModel::kUniform ) {
+            do {
+                ancestral = allele_freq_distrib( engine );
+            } while( ancestral <= 0.0 );
+        }
+
+        // Go through all samples.
+        for( size_t s = 0; s < sample_count; ++s ) {
+            // Simulate a coverage for the sample.
+            auto const coverage = draw_coverage_( s );
+
+            // Draw major allele frequency for the sample. If this is an invariant position,
+            // we use a frequency of 1, and with that can simply use the same code for
+            // mutated and invariant positions for the writing below.
+            auto fraction
+                = ! is_mutation
+                ? 1.0
+                : draw_frequency_( ancestral )
+            ;
+
+            // Distribute the coverage to the two alleles. By default, we simply split the coverage
+            // according to the frequency. With read sampling, we instead first draw the pool of
+            // individuals (if pool sizes are given), and then draw the reads from that.
+            // We use an array of counts to store them, in the order of sync files, ATCG N D.
+            // This works for now. For pileup, we just access the alleles that we need,
+            // but ignore the rest.
+            std::array<size_t, 6> counts = { 0, 0, 0, 0, 0, 0 };
+            if( options.sample_reads.value ) {
+                if( ! settings.pool_sizes.empty() ) {
+                    auto const pool_size = settings.pool_sizes[s];
+                    auto const pool_major = draw_binomial_( pool_size, fraction );
+                    fraction = static_cast<double>( pool_major ) / static_cast<double>( pool_size );
+                }
+                counts[ a1 ] = draw_binomial_( coverage, fraction );
+            } else {
+                counts[ a1 ] = coverage * fraction;
+            }
+            counts[ a2 ] = coverage - counts[ a1 ];
+
+            // Sequencing errors, using the average error probability. This is not used for
+            // pileups with quality scores, where each read gets its own error probability below.
+            bool const per_read_quality = (
+                settings.format == SimulateFormat::kPileup && options.with_quality_scores.value
+            );
+            if( options.sequencing_errors.value && ! per_read_quality ) {
+                auto const true_counts = counts;
+                add_sequencing_errors_( true_counts, counts, a1 );
+                add_sequencing_errors_( true_counts, counts, a2 );
+            }
+
+            // Write sample.
+            switch( settings.format ) {
+                case SimulateFormat::kPileup: {
+                    buffer.push_back( '\t' );
+                    append_unsigned( buffer, coverage );
+                    buffer.push_back( '\t' );
+
+                    // Without quality scores, pileup needs repeated chars of each allele.
+                    // For simplicity, we just output all of them in order.
+                    if( ! per_read_quality ) {
+                        for( size_t i = 0; i < 4; ++i ) {
+                            buffer.append( counts[ i ], allele_to_char_( i ));
+                        }
+                        break;
+                    }
+
+                    // With quality scores, we draw a score for each read, which also determines
+                    // the probability that the read shows a sequencing error.
+                    qualities.clear();
+                    for( auto const allele : { a1, a2 } ) {
+                        for( size_t i = 0; i < counts[ allele ]; ++i ) {
+                            auto const score = phred_scores_distrib( engine );
+                            auto base = allele;
+                            if(
+                                options.sequencing_errors.value &&
+                                allele_freq_distrib( engine ) < settings.error_probabilities[ score ]
+                            ) {
+                                base = ( allele + second_allele_distrib( engine )) % 4;
+                            }
+                            buffer.push_back( allele_to_char_( base ));
+                            qualities.push_back( quality_encode_from_phred_score( score ));
+                        }
+                    }
+                    buffer.push_back( '\t' );
+                    buffer.append( qualities );
+                    break;
+                }
+                case SimulateFormat::kSync: {
+                    // Sync is simpler, and just needs the counts of each of the 6 different values
+                    // (ACGT, as well as N and D for deletions).
+                    buffer.push_back( '\t' );
+                    append_unsigned( buffer, counts[0] );
+                    for( size_t i = 1; i < 6; ++i ) {
+                        buffer.push_back( ':' );
+                        append_unsigned( buffer, counts[i] );
+                    }
+                    break;
+                }
+                case SimulateFormat::kVcf: {
+                    // Keep the counts, and write the whole line once all samples are done.
+                    vcf_counts[s] = counts;
+                    break;
+                }
+            }
+        }
+        if( settings.format == SimulateFormat::kVcf ) {
+            append_vcf_line_( buffer, chromosome, position, a1, a2, vcf_counts );
+        }
+        buffer.push_back( '\n' );
+    };
+
+    // Simulate either only the mutated positions, or all positions of the block.
+    if( options.omit_invariant_positions.value ) {
+        for( auto const position : block.mutations ) {
+            simulate_position_( position, true );
+        }
+    } else {
+        size_t mutation_index = 0;
+        for( size_t position = block.first_position; position <= block.last_position; ++position ) {
+            bool const is_mutation = (
+                mutation_index < block.mutations.size() &&
+                block.mutations[ mutation_index ] == position
+            );
+            if( is_mutation ) {
+                ++mutation_index;
+            }
+            simulate_position_( position, is_mutation );
+        }
+        assert( mutation_index == block.mutations.size() );
+    }
+}
+
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -282,16 +1074,34 @@ void run_simulate( SimulateOptions const& options )
     // User friendly check.
     options.file_output.check_output_files_nonexistence( "simulate", options.format.value );
 
-    // Get the format, and store it in a an enum for access speed.
-    auto const format = get_format( options );
+    // Get the format and the coverage model, and store them in enums for access speed.
+    SimulateSettings settings;
+    settings.format = get_format( options );
+    settings.coverage_model = get_enum_map_value(
+        coverage_model_map, options.coverage_model.value
+    );
+    settings.frequency_model = get_enum_map_value(
+        frequency_model_map, options.frequency_model.value
+    );
+
+    // Check the F_ST, which needs to be strictly between 0 and 1 for the Beta distribution.
+    if(
+        settings.frequency_model == FrequencyModel::kBaldingNichols &&
+        ( options.fst.value <= 0.0 || options.fst.value >= 1.0 )
+    ) {
+        throw CLI::ValidationError(
+            options.fst.option->get_name(),
+            "Invalid F_ST value " + std::to_string( options.fst.value ) + ", which needs to be "
+            "in the open interval (0, 1)."
+        );
+    }
 
     // Get a random seed, either from the option if used, or using the current time.
-    auto const seed
+    std::uint64_t const seed
         = *options.random_seed.option
         ? options.random_seed.value
         : std::chrono::system_clock::now().time_since_epoch().count()
     ;
-    std::default_random_engine engine(seed);
 
     // Check phred score validity.
     if( options.min_phred_score.value > options.max_phred_score.value ) {
@@ -303,10 +1113,68 @@ void run_simulate( SimulateOptions const& options )
         );
     }
 
+    // Get the error probabilities of all phred scores, and their average across the range
+    // of scores that we draw from, which is used when not simulating individual reads.
+    for( size_t i = 0; i <= options.max_phred_score.value; ++i ) {
+        settings.error_probabilities.push_back( phred_score_to_error_probability( i ));
+        if( i >= options.min_phred_score.value ) {
+            settings.mean_error_probability += settings.error_probabilities.back();
+        }
+    }
+    settings.mean_error_probability /= static_cast<double>(
+        options.max_phred_score.value - options.min_phred_score.value + 1
+    );
+
     // Get coverages and sample count (length of coverage list).
-    auto const sample_coverages = get_coverages_( options );
+    // For the distribution models, we need a single mean coverage per sample.
+    settings.sample_coverages = get_coverages_( options );
+    auto const& sample_coverages = settings.sample_coverages;
+    if( settings.coverage_model != CoverageModel::kUniform ) {
+        for( auto const& coverage : sample_coverages ) {
+            if( coverage.first != coverage.second || coverage.first == 0 ) {
+                throw CLI::ValidationError(
+                    options.coverages.option->get_name(),
+                    "With " + options.coverage_model.option->get_name() + " " +
+                    options.coverage_model.value + ", the coverages need to be given as a single "
+                    "positive mean coverage per sample."
+                );
+            }
+        }
+    }
+
+    // Get the pool sizes, if given. The samples do not have names, so we use their numbers,
+    // as we do when reading files without sample names.
+    if( options.poolsizes.provided() ) {
+        if( ! options.sample_reads.value ) {
+            throw CLI::ValidationError(
+                options.sample_reads.option->get_name(),
+                "Pool sizes can only be used when reads are sampled via " +
+                options.sample_reads.option->get_name() + "."
+            );
+        }
+        std::vector<std::string> sample_names;
+        for( size_t i = 0; i < sample_coverages.size(); ++i ) {
+            sample_names.push_back( std::to_string( i + 1 ));
+        }
+        settings.pool_sizes = options.poolsizes.get_pool_sizes( sample_names );
+        for( auto const pool_size : settings.pool_sizes ) {
+            if( pool_size == 0 ) {
+                throw CLI::ValidationError(
+                    "--pool-sizes",
+                    "Pool sizes need to be positive."
+                );
+            }
+        }
+    }
+
+    // Get the chromosomes, and their total length.
+    settings.chromosomes = get_chromosomes_( options );
+    size_t total_length = 0;
+    for( auto const& chromosome : settings.chromosomes ) {
+        total_length += chromosome.second;
+    }
 
-    // Get and check mutation count to avoid infinite loop when picking mutation positions.
+    // Get and check mutation count, as we cannot have more mutations than positions.
     if( ! *options.mutation_count.option && ! *options.mutation_rate.option ) {
         throw CLI::ValidationError(
             "Either " + options.mutation_count.option->get_name() + " or " +
@@ -316,16 +1184,16 @@ void run_simulate( SimulateOptions const& options )
     size_t const mutation_count
         = *options.mutation_count.option
         ? options.mutation_count.value
-        : static_cast<size_t>( options.mutation_rate.value * options.length.value )
+        : static_cast<size_t>( options.mutation_rate.value * total_length )
     ;
-    if( options.mutation_count.value >= options.length.value ) {
+    if( mutation_count > total_length ) {
         throw CLI::ValidationError(
             options.mutation_count.option->get_name() + "(" +
-            std::to_string( options.mutation_count.value ) + ")",
+            std::to_string( mutation_count ) + ")",
             "Cannot create more mutation positions than genome length."
         );
     }
-    LOG_MSG << "Generating genome of length " << options.length.value << " with a total of "
+    LOG_MSG << "Generating genome of length " << total_length << " with a total of "
             << mutation_count << " mutated positions, for " << sample_coverages.size()
             << " sample" << ( sample_coverages.size() == 1 ? "" : "s" ) << ".";
     if( mutation_count == 0 ) {
@@ -333,110 +1201,96 @@ void run_simulate( SimulateOptions const& options )
                  << "Consider increasing " << options.mutation_rate.option->get_name();
     }
 
-    // Use an unordered_set to collect all positions that we simulate as mutations beforehand.
-    // Generating random positions a priori allows us to ensure that we hit the exact genome length.
-    // Alternatively, we could use a geometric distribution to draw "skip" distances between
-    // mutations, but this might by chance lead to different lengths of the resulting genome.
-    // We use a set here, so that we can draw positions without duplicates until we have enough.
-    std::unordered_set<size_t> mutation_positions;
-    std::uniform_int_distribution<size_t> mutation_positions_distrib( 1, options.length.value );
-    while( mutation_positions.size() < mutation_count ) {
-        mutation_positions.emplace( mutation_positions_distrib( engine ));
-    }
-
-    // Prepare distributions for allele identities, allele frequencies, and phred scores.
-    std::uniform_int_distribution<size_t> first_allele_distrib( 0, 3 );
-    std::uniform_int_distribution<size_t> second_allele_distrib( 1, 3 );
-    std::uniform_real_distribution<double> allele_freq_distrib( 0.0, 1.0 );
-    std::uniform_int_distribution<unsigned char> phred_scores_distrib(
-        options.min_phred_score.value,
-        options.max_phred_score.value
-    );
-
-    // Prepare distributions for per sample coverages.
-    std::vector<std::uniform_int_distribution<size_t>> sample_coverage_distribs;
-    for( auto const& coverage : sample_coverages ) {
-        sample_coverage_distribs.emplace_back( coverage.first, coverage.second );
-    }
+    // We draw the mutated positions in increasing order while iterating the genome, which uses
+    // constant memory, and yields exactly the requested number of mutations across the length.
+    // The positions are across the concatenation of all chromosomes, and we store the next
+    // mutated position, or zero if there are none left (positions are 1-based).
+    // The mutations use their own random stream, independent of the streams of the blocks below.
+    PhiloxEngine mutation_engine( seed, 0 );
+    SequentialPositionSampler mutation_sampler( mutation_count, total_length );
+    size_t next_mutation = mutation_sampler ? mutation_sampler.next( mutation_engine ) : 0;
 
     // -------------------------------------------------------------------------
     //     Run the generation
     // -------------------------------------------------------------------------
 
-    // We iterate all positions, but might skip invariant as needed.
-    auto sim_ofs = options.file_output.get_output_target( "simulate", options.format.value );
-    for( size_t position = 1; position <= options.length.value; ++position ) {
-
-        // Might not want to write to the file if this is an invariant position.
-        if( options.omit_invariant_positions.value && mutation_positions.count( position ) == 0 ) {
-            continue;
+    // Each chromosome is split into blocks of a fixed number of positions, which are simulated in
+    // parallel, and written in order. Each block uses its own random stream, keyed by the seed and
+    // the block index, so that the output only depends on the seed, but not on the number of
+    // threads. We process the blocks in waves of a few blocks per thread, to limit memory usage.
+    // For high coverages, lines get long, so we estimate their length from the settings, and use
+    // smaller blocks in that case, so that the buffer of each block stays at around a megabyte.
+    size_t line_length = 32;
+    for( auto const& coverage : sample_coverages ) {
+        if( settings.format == SimulateFormat::kSync ) {
+            line_length += 6 * 8;
+        } else if( settings.format == SimulateFormat::kVcf ) {
+            line_length += 4 * 8;
+        } else {
+            auto const reads = std::max( coverage.first, coverage.second );
+            line_length += 16 + reads * ( options.with_quality_scores.value ? 2 : 1 );
         }
+    }
+    size_t const block_size = std::max<size_t>(
+        1, std::min<size_t>( 65536, ( 1 << 20 ) / line_length )
+    );
+    size_t const wave_size = 4 * global_options.opt_threads.value;
+    auto blocks = std::vector<SimulateBlock>( wave_size );
 
-        // Draw two alleles (we are only doing biallelic for now).
-        // The second is drawn so that it differes from the first one.
-        // It might not be used if this is an invariant position. We draw it anyway.
-        auto const a1 = first_allele_distrib( engine );
-        auto const a2 = ( a1 + second_allele_distrib( engine ) ) % 4;
+    // State of where we are in the genome, that is, the next block to set up.
+    size_t block_index = 0;
+    size_t chromosome_index = 0;
+    size_t chromosome_offset = 0;
+    size_t block_start = 1;
 
-        // Write fixed columns: chromosome, position, referece base.
-        // Same for pileup and sync. If more formats are added, this might need to be changed.
-        (*sim_ofs) << options.chromosome.value;
-        (*sim_ofs) << "\t" << position;
-        (*sim_ofs) << "\t" << allele_to_char_( a1 );
+    auto sim_ofs = options.file_output.get_output_target( "simulate", options.format.value );
+    if( settings.format == SimulateFormat::kVcf ) {
+        write_vcf_header_( settings, sim_ofs );
+    }
+    while( chromosome_index < settings.chromosomes.size() ) {
 
-        // Go through all samples.
-        for( size_t s = 0; s < sample_coverages.size(); ++s ) {
-            // Simulate a coverage for the sample.
-            auto const coverage = sample_coverage_distribs[s]( engine );
+        // Set up the blocks of this wave. The mutated positions need to be drawn in order,
+        // so we do this here on the main thread, and hand them over to the blocks.
+        size_t wave_count = 0;
+        while( wave_count < wave_size && chromosome_index < settings.chromosomes.size() ) {
+            auto const chromosome_length = settings.chromosomes[ chromosome_index ].second;
+            auto& block = blocks[ wave_count ];
+            block.index = block_index;
+            block.chromosome_index = chromosome_index;
+            block.first_position = block_start;
+            block.last_position = std::min( block_start + block_size - 1, chromosome_length );
+            block.mutations.clear();
+            while(
+                next_mutation != 0 && next_mutation <= chromosome_offset + block.last_position
+            ) {
+                assert( next_mutation >= chromosome_offset + block.first_position );
+                block.mutations.push_back( next_mutation - chromosome_offset );
+                next_mutation = mutation_sampler ? mutation_sampler.next( mutation_engine ) : 0;
+            }
+            ++wave_count;
+            ++block_index;
 
-            // Draw major allele frequency for the sample. If this is an invariant position,
-            // we use a frequency of 1, and with that can simply use the same code for
-            // mutated and invariant positions for the writing below.
-            auto const fraction
-                = mutation_positions.count( position ) == 0
-                ? 1.0
-                : allele_freq_distrib( engine )
-            ;
+            // Move to the next block, which might be on the next chromosome.
+            if( block.last_position == chromosome_length ) {
+                chromosome_offset += chromosome_length;
+                ++chromosome_index;
+                block_start = 1;
+            } else {
+                block_start = block.last_position + 1;
+            }
+        }
 
-            // Distribute the coverage to the two alleles. For simplicity, we assume
-            // read count = coverage at every position. Might elaborate on this in the future.
-            // We use an array of counts to store them, in the order of sync files, ATCG N D.
-            // This works for now. For pileup, we just access the two alleles that we need,
-            // but ignore the rest.
-            std::array<size_t, 6> counts = { 0, 0, 0, 0, 0, 0 };
-            counts[ a1 ] = coverage * fraction;
-            counts[ a2 ] = coverage - counts[ a1 ];
+        // Simulate all blocks of the wave in parallel.
+        #pragma omp parallel for schedule( dynamic )
+        for( size_t b = 0; b < wave_count; ++b ) {
+            simulate_block_( options, settings, seed, blocks[b] );
+        }
 
-            // Write sample.
-            switch( format ) {
-                case SimulateFormat::kPileup: {
-                    // Pileup needs repeated chars of each of the two alleles.
-                    // For simplicity, we just output both of them in order.
-                    (*sim_ofs) << "\t" << coverage << "\t";
-                    (*sim_ofs) << std::string( counts[ a1 ], allele_to_char_( a1 ) );
-                    (*sim_ofs) << std::string( counts[ a2 ], allele_to_char_( a2 ) );
-
-                    // Draw and write some random quality scores if needed.
-                    if( options.with_quality_scores.value ) {
-                        (*sim_ofs) << "\t";
-                        for( size_t i = 0; i < coverage; ++i ) {
-                            auto const score = phred_scores_distrib( engine );
-                            (*sim_ofs) << quality_encode_from_phred_score( score );
-                        }
-                    }
-                    break;
-                }
-                case SimulateFormat::kSync: {
-                    // Sync is simpler, and just needs the counts of each of the 6 different values
-                    // (ACGT, as well as N and D for deletions).
-                    (*sim_ofs) << "\t" << counts[0];
-                    for( size_t i = 1; i < 6; ++i ) {
-                        (*sim_ofs) << ":" << counts[i];
-                    }
-                    break;
-                }
-            }
+        // Write them in order.
+        for( size_t b = 0; b < wave_count; ++b ) {
+            auto& block = blocks[b];
+            sim_ofs->ostream().write( block.buffer.data(), block.buffer.size() );
         }
-        (*sim_ofs) << "\n";
     }
+    assert( next_mutation == 0 );
 }
@@ -27,6 +27,7 @@
 #include "CLI/CLI.hpp"
 
 #include "options/file_output.hpp"
+#include "options/poolsizes.hpp"
 #include "tools/cli_option.hpp"
 
 #include <cstdint>
@@ -53,8 +54,22 @@ public:
     CliOption<double> mutation_rate = 1e-8;
     CliOption<size_t> mutation_count;
     CliOption<size_t> length;
+    CliOption<std::string> chromosome_lengths;
     CliOption<bool> omit_invariant_positions = false;
 
+    // Allele frequency model
+    CliOption<std::string> frequency_model = "uniform";
+    CliOption<double> fst = 0.1;
+    CliOption<size_t> wright_fisher_generations = 100;
+    CliOption<size_t> wright_fisher_population_size = 1000;
+
+    // Read sampling model
+    CliOption<std::string> coverage_model = "uniform";
+    CliOption<double> coverage_dispersion = 10.0;
+    CliOption<bool> sample_reads = false;
+    PoolsizesOptions poolsizes;
+    CliOption<bool> sequencing_errors = false;
+
     // Pileup quality scores
     CliOption<bool> with_quality_scores = false;
     CliOption<size_t> min_phred_score = 10;
@@ -0,0 +1,334 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/stats.hpp"
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/text_buffer.hpp"
+
+#include "genesis/population/functions/base_counts.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_stats( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto options = std::make_shared<StatsOptions>();
+    auto sub = app.add_subcommand(
+        "stats",
+        "Compute per-sample and per-chromosome statistics of the coverage, missing data, "
+        "and allele counts of the input, for example to choose filter settings. The coverage "
+        "distributions are written in the format of `--coverage-stats-file`, so that they can be "
+        "used by other commands run with the same input and filter settings."
+    );
+
+    // Required input of some frequency format.
+    options->freq_input.add_frequency_input_opts_to_app( sub );
+    options->freq_input.add_sample_name_opts_to_app( sub );
+    // Invariant positions cannot be skipped, as the statistics are over all positions.
+    // Subsampling is not offered either, as the coverage histogram is meant to be used as
+    // a `--coverage-stats-file` by other commands, which needs the coverages as read.
+    options->freq_input.add_filter_opts_to_app( sub, false, false );
+
+    // Add table output options.
+    options->table_output.add_separator_char_opt_to_app( sub );
+    options->table_output.add_na_entry_opt_to_app( sub );
+
+    // Output
+    options->file_output.add_default_output_opts_to_app( sub );
+    options->file_output.add_file_compress_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( grenedalf_cli_callback(
+        sub,
+        {
+            // Citation keys as needed
+        },
+        [ options ]() {
+            run_stats( *options );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Maximum minor allele count that we keep track of. Higher counts go into the last entry.
+ */
+static const size_t stats_max_minor_allele_count_ = 255;
+
+/**
+ * @brief Statistics of a chromosome, with an entry per sample.
+ */
+struct ChromosomeStats
+{
+    std::string name;
+    size_t position_count = 0;
+    std::vector<size_t> covered_counts;
+    std::vector<size_t> coverage_sums;
+};
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_stats( StatsOptions const& options )
+{
+    using namespace genesis::population;
+
+    // Check that all output files can be written.
+    options.file_output.check_output_files_nonexistence(
+        { "stats-samples", "stats-chromosomes", "stats-coverage", "stats-minor-allele-counts" },
+        "csv"
+    );
+
+    auto const& sample_names = options.freq_input.sample_names();
+    auto const sample_count = sample_names.size();
+    auto const max_coverage_bin = FrequencyInputOptions::coverage_histogram_size - 1;
+
+    // Per-sample histograms of the coverage and of the minor allele count,
+    // as well as the exact maximum coverage and the number of SNPs.
+    auto coverage_histograms = std::vector<std::vector<size_t>>(
+        sample_count, std::vector<size_t>( FrequencyInputOptions::coverage_histogram_size, 0 )
+    );
+    auto minor_allele_histograms = std::vector<std::vector<size_t>>(
+        sample_count, std::vector<size_t>( stats_max_minor_allele_count_ + 1, 0 )
+    );
+    auto max_coverages = std::vector<size_t>( sample_count, 0 );
+    auto snp_counts = std::vector<size_t>( sample_count, 0 );
+    std::vector<ChromosomeStats> chromosomes;
+
+    // -------------------------------------------------------------------------
+    //     Main Loop
+    // -------------------------------------------------------------------------
+
+    // Reading the input is sequential, so we collect the positions in batches, which are then
+    // processed in parallel. Each thread processes whole samples, so that the histograms of a
+    // sample are only touched by one thread, and do not need to be merged or synchronized.
+    // The entries of the batch are re-used, to avoid re-allocating their memory.
+    size_t const batch_size = 4096;
+    std::vector<Variant> batch;
+    std::vector<size_t> batch_chromosomes;
+    size_t batch_used = 0;
+
+    auto process_batch_ = [&](){
+        #pragma omp parallel for
+        for( size_t i = 0; i < sample_count; ++i ) {
+            auto& coverage_histogram = coverage_histograms[i];
+            auto& minor_allele_histogram = minor_allele_histograms[i];
+            for( size_t b = 0; b < batch_used; ++b ) {
+                auto const& sample = batch[b].samples[i];
+
+                // Coverage, only considering the nucleotides, as usual.
+                auto const cov = sample.a_count + sample.c_count + sample.g_count + sample.t_count;
+                ++coverage_histogram[ std::min( cov, max_coverage_bin ) ];
+                max_coverages[i] = std::max( max_coverages[i], cov );
+
+                // Per chromosome sums.
+                auto& chromosome = chromosomes[ batch_chromosomes[b] ];
+                chromosome.covered_counts[i] += static_cast<size_t>( cov > 0 );
+                chromosome.coverage_sums[i]  += cov;
+                if( cov == 0 ) {
+                    continue;
+                }
+
+                // Minor allele count, that is, the second highest count of the nucleotides.
+                std::array<size_t, 4> counts = {{
+                    sample.a_count, sample.c_count, sample.g_count, sample.t_count
+                }};
+                std::partial_sort( counts.begin(), counts.begin() + 2, counts.end(),
+                    []( size_t l, size_t r ){ return l > r; }
+                );
+                ++minor_allele_histogram[ std::min( counts[1], stats_max_minor_allele_count_ ) ];
+                snp_counts[i] += static_cast<size_t>( counts[1] > 0 );
+            }
+        }
+        batch_used = 0;
+    };
+
+    // Iterate the input, and keep track of the chromosomes.
+    size_t pos_cnt = 0;
+    for( auto const& variant : options.freq_input.get_iterator() ) {
+        if( variant.samples.size() != sample_count ) {
+            throw std::runtime_error(
+                "Input has inconsistent number of samples at " + variant.chromosome + ":" +
+                std::to_string( variant.position )
+            );
+        }
+        if( chromosomes.empty() || chromosomes.back().name != variant.chromosome ) {
+            LOG_MSG << "At chromosome " << variant.chromosome;
+            ChromosomeStats chromosome;
+            chromosome.name = variant.chromosome;
+            chromosome.covered_counts.resize( sample_count, 0 );
+            chromosome.coverage_sums.resize( sample_count, 0 );
+            chromosomes.push_back( std::move( chromosome ));
+        }
+        ++chromosomes.back().position_count;
+        ++pos_cnt;
+
+        // Add to the batch, re-using the entries.
+        if( batch_used < batch.size() ) {
+            batch[ batch_used ] = variant;
+            batch_chromosomes[ batch_used ] = chromosomes.size() - 1;
+        } else {
+            batch.push_back( variant );
+            batch_chromosomes.push_back( chromosomes.size() - 1 );
+        }
+        ++batch_used;
+        if( batch_used == batch_size ) {
+            process_batch_();
+        }
+    }
+    process_batch_();
+
+    // -------------------------------------------------------------------------
+    //     Output
+    // -------------------------------------------------------------------------
+
+    auto const sep_char = options.table_output.get_separator_char();
+    auto const& na_entry = options.table_output.get_na_entry();
+    auto write_ratio_ = [&]( std::string& buffer, size_t numerator, size_t denominator ){
+        buffer.push_back( sep_char );
+        if( denominator > 0 ) {
+            append_double(
+                buffer, static_cast<double>( numerator ) / static_cast<double>( denominator )
+            );
+        } else {
+            buffer.append( na_entry );
+        }
+    };
+    std::string buffer;
+
+    // Per sample summary.
+    {
+        auto ofs = options.file_output.get_output_target( "stats-samples", "csv" );
+        (*ofs) << "SAMPLE" << sep_char << "POS_CNT" << sep_char << "COVERED_CNT";
+        (*ofs) << sep_char << "MISSING_FRAC" << sep_char << "MEAN_COV";
+        (*ofs) << sep_char << "COV_Q02" << sep_char << "COV_Q25" << sep_char << "MEDIAN_COV";
+        (*ofs) << sep_char << "COV_Q75" << sep_char << "COV_Q98" << sep_char << "MAX_COV";
+        (*ofs) << sep_char << "SNP_CNT" << "\n";
+
+        for( size_t i = 0; i < sample_count; ++i ) {
+            size_t covered = 0;
+            size_t coverage_sum = 0;
+            for( auto const& chromosome : chromosomes ) {
+                covered += chromosome.covered_counts[i];
+                coverage_sum += chromosome.coverage_sums[i];
+            }
+
+            buffer.clear();
+            buffer.append( sample_names[i] );
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, pos_cnt );
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, covered );
+            write_ratio_( buffer, pos_cnt - covered, pos_cnt );
+            write_ratio_( buffer, coverage_sum, covered );
+            for( auto const quantile : { 0.02, 0.25, 0.5, 0.75, 0.98 } ) {
+                buffer.push_back( sep_char );
+                append_unsigned( buffer, FrequencyInputOptions::coverage_histogram_quantile(
+                    coverage_histograms[i], quantile
+                ));
+            }
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, max_coverages[i] );
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, snp_counts[i] );
+            buffer.push_back( '\n' );
+            ofs->ostream() << buffer;
+        }
+    }
+
+    // Per chromosome summary.
+    {
+        auto ofs = options.file_output.get_output_target( "stats-chromosomes", "csv" );
+        (*ofs) << "CHROM" << sep_char << "POS_CNT";
+        for( auto const& sample : sample_names ) {
+            (*ofs) << sep_char << sample << ".COVERED_CNT";
+            (*ofs) << sep_char << sample << ".MEAN_COV";
+        }
+        (*ofs) << "\n";
+
+        for( auto const& chromosome : chromosomes ) {
+            buffer.clear();
+            buffer.append( chromosome.name );
+            buffer.push_back( sep_char );
+            append_unsigned( buffer, chromosome.position_count );
+            for( size_t i = 0; i < sample_count; ++i ) {
+                buffer.push_back( sep_char );
+                append_unsigned( buffer, chromosome.covered_counts[i] );
+                write_ratio_( buffer, chromosome.coverage_sums[i], chromosome.covered_counts[i] );
+            }
+            buffer.push_back( '\n' );
+            ofs->ostream() << buffer;
+        }
+    }
+
+    // Coverage histograms, in the format that can be used as `--coverage-stats-file`.
+    // That format is always tab-separated, so that it can be read again.
+    {
+        auto ofs = options.file_output.get_output_target( "stats-coverage", "csv" );
+        FrequencyInputOptions::write_coverage_histograms(
+            ofs->ostream(), sample_names, coverage_histograms
+        );
+    }
+
+    // Minor allele count histograms.
+    {
+        auto ofs = options.file_output.get_output_target( "stats-minor-allele-counts", "csv" );
+        (*ofs) << "MINOR_ALLELE_CNT";
+        for( auto const& sample : sample_names ) {
+            (*ofs) << sep_char << sample;
+        }
+        (*ofs) << "\n";
+        for( size_t c = 0; c <= stats_max_minor_allele_count_; ++c ) {
+            buffer.clear();
+            append_unsigned( buffer, c );
+            for( size_t i = 0; i < sample_count; ++i ) {
+                buffer.push_back( sep_char );
+                append_unsigned( buffer, minor_allele_histograms[i][c] );
+            }
+            buffer.push_back( '\n' );
+            ofs->ostream() << buffer;
+        }
+    }
+
+    LOG_MSG << "\nProcessed " << chromosomes.size() << " chromosome"
+            << ( chromosomes.size() != 1 ? "s" : "" )
+            << " with " << pos_cnt << " total position" << ( pos_cnt != 1 ? "s" : "" );
+}
@@ -24,10 +24,14 @@
 #include "commands/sync_file.hpp"
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/ordered_batches.hpp"
+#include "tools/text_buffer.hpp"
 
 #include "genesis/population/functions/base_counts.hpp"
 #include "genesis/population/functions/variant.hpp"
 
+#include <string>
+
 // =================================================================================================
 //      Setup
 // =================================================================================================
@@ -65,6 +69,40 @@ void setup_sync_file( CLI::App& app )
     ));
 }
 
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Append a Variant as a line in sync format to a @p buffer.
+ *
+ * This produces the same output as `to_sync()`, but avoids the stream overhead,
+ * so that it can be used to format many lines in parallel.
+ */
+void append_sync_line_( genesis::population::Variant const& variant, std::string& buffer )
+{
+    buffer.append( variant.chromosome );
+    buffer.push_back( '\t' );
+    append_unsigned( buffer, variant.position );
+    buffer.push_back( '\t' );
+    buffer.push_back( variant.reference_base );
+    for( auto const& sample : variant.samples ) {
+        buffer.push_back( '\t' );
+        append_unsigned( buffer, sample.a_count );
+        buffer.push_back( ':' );
+        append_unsigned( buffer, sample.t_count );
+        buffer.push_back( ':' );
+        append_unsigned( buffer, sample.c_count );
+        buffer.push_back( ':' );
+        append_unsigned( buffer, sample.g_count );
+        buffer.push_back( ':' );
+        append_unsigned( buffer, sample.n_count );
+        buffer.push_back( ':' );
+        append_unsigned( buffer, sample.d_count );
+    }
+    buffer.push_back( '\n' );
+}
+
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -76,9 +114,20 @@ void run_sync_file( SyncFileOptions const& options )
     options.file_output.check_output_files_nonexistence( "counts", "sync" );
     auto sync_ofs = options.file_output.get_output_target( "counts", "sync" );
 
-    // Write the sync data
-    for( auto const& freq_it : options.freq_input.get_iterator() ) {
-        to_sync( freq_it, sync_ofs->ostream() );
-        // (*sync_ofs) << "\n";
+    // If the input already is a sync file, we can simply copy the relevant parts of each line,
+    // which is way faster than parsing the counts and formatting them again.
+    if( options.freq_input.is_sync_passthrough_possible() ) {
+        options.freq_input.write_sync_passthrough( sync_ofs->ostream() );
+        return;
     }
+
+    // Write the sync data. Reading the input is sequential, but we format the lines in parallel,
+    // in batches of positions that are then written in order.
+    write_ordered_batches<Variant>(
+        options.freq_input.get_iterator(),
+        sync_ofs->ostream(),
+        []( Variant const& variant, std::string& buffer ){
+            append_sync_line_( variant, buffer );
+        }
+    );
 }
@@ -24,7 +24,10 @@
 #include "options/frequency_input.hpp"
 
 #include "options/global.hpp"
+#include "tools/genome_mask.hpp"
 #include "tools/misc.hpp"
+#include "tools/random.hpp"
+#include "tools/reference_genome.hpp"
 
 #include "genesis/population/formats/variant_pileup_input_iterator.hpp"
 #include "genesis/population/formats/variant_pileup_reader.hpp"
@@ -37,17 +40,25 @@
 #include "genesis/sequence/functions/quality.hpp"
 #include "genesis/utils/containers/filter_iterator.hpp"
 #include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/io/input_stream.hpp"
 #include "genesis/utils/text/string.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
 #include <memory>
+#include <ostream>
 #include <stdexcept>
 
 // =================================================================================================
 //      Setup Functions
 // =================================================================================================
 
+const size_t FrequencyInputOptions::coverage_histogram_size;
+
 // -------------------------------------------------------------------------
 //     All Input File Types
 // -------------------------------------------------------------------------
@@ -74,6 +85,20 @@ void FrequencyInputOptions::add_frequency_input_opts_to_app(
     vcf_file_.option->excludes( pileup_file_.option );
     vcf_file_.option->excludes( sync_file_.option );
 
+    // Reference genome, for all input file types.
+    reference_genome_file_.option = sub->add_option(
+        "--reference-genome",
+        reference_genome_file_.value,
+        "Path to an uncompressed FASTA file with the reference genome, with an index file `.fai` "
+        "next to it, as created by `samtools faidx`. If given, the reference bases of all positions "
+        "are taken from this file, instead of from the input file, which for example for sync "
+        "and (m)pileup files might not contain reliable reference bases. Furthermore, for "
+        "`diversity`, the lengths of the chromosomes are used for the number of callable "
+        "positions per window, and its windows then extend to the chromosome ends."
+    );
+    reference_genome_file_.option->check( CLI::ExistingFile );
+    reference_genome_file_.option->group( group );
+
     // // Additional options.
     // if( with_sample_name_opts ) {
     //     add_sample_name_opts_to_app( sub, group );
@@ -248,6 +273,8 @@ void FrequencyInputOptions::add_sample_name_opts_to_app(
 
 void FrequencyInputOptions::add_filter_opts_to_app(
     CLI::App* sub,
+    bool with_skip_invariant_positions,
+    bool with_subsampling,
     std::string const& group
 ) {
     // Correct setup check.
@@ -292,6 +319,126 @@ void FrequencyInputOptions::add_filter_opts_to_app(
     // Include and exclude are mutually exclusive.
     filter_samples_exclude_.option->excludes( filter_samples_include_.option );
     filter_samples_include_.option->excludes( filter_samples_exclude_.option );
+
+    // Add option for the minimum allele count.
+    filter_min_allele_count_.option = sub->add_option(
+        "--filter-min-allele-count",
+        filter_min_allele_count_.value,
+        "Minimum count of each nucleotide in a sample. Counts below this are considered to be "
+        "sequencing errors, and set to zero when reading the input, before any other processing."
+    );
+    filter_min_allele_count_.option->group( group );
+
+    // Add options for the coverage range.
+    filter_min_coverage_.option = sub->add_option(
+        "--filter-min-coverage",
+        filter_min_coverage_.value,
+        "Minimum coverage of a sample at a position, that is, the sum of its nucleotide counts "
+        "(after applying `--filter-min-allele-count`). Samples with a lower coverage are masked, "
+        "that is, their counts are set to zero, and positions where all samples are masked are "
+        "skipped when reading the input."
+    );
+    filter_min_coverage_.option->group( group );
+    filter_max_coverage_.option = sub->add_option(
+        "--filter-max-coverage",
+        filter_max_coverage_.value,
+        "Maximum coverage of a sample at a position, with the same masking and skipping as "
+        "`--filter-min-coverage`. If set to 0 (default), no maximum is applied."
+    );
+    filter_max_coverage_.option->group( group );
+
+    // Add options for the adaptive maximum coverage.
+    filter_max_coverage_quantile_.option = sub->add_option(
+        "--filter-max-coverage-quantile",
+        filter_max_coverage_quantile_.value,
+        "Quantile of the coverage of each sample to use as its maximum coverage, for example 0.98 "
+        "to mask the 2% of positions with the highest coverage in each sample, with the same "
+        "masking and skipping as `--filter-max-coverage`. This needs an additional pass over the "
+        "input to get the coverage distribution of each sample, using all positions that pass "
+        "the other filters, unless `--coverage-stats-file` is given as an existing file."
+    );
+    filter_max_coverage_quantile_.option->check( CLI::Range( 0.0, 1.0 ));
+    filter_max_coverage_quantile_.option->group( group );
+    coverage_stats_file_.option = sub->add_option(
+        "--coverage-stats-file",
+        coverage_stats_file_.value,
+        "File to cache the coverage distributions needed for `--filter-max-coverage-quantile`. "
+        "If the file exists, the distributions are read from it, instead of doing the additional "
+        "pass over the input; otherwise, they are written to it, so that later runs with the same "
+        "input and filter settings, also of other commands, can re-use them. The file is a table "
+        "with a column per sample, and a row per coverage value, counting the positions with that "
+        "coverage. Coverages above " + std::to_string( coverage_histogram_size - 1 ) + " are "
+        "counted in the last row."
+    );
+    coverage_stats_file_.option->group( group );
+    coverage_stats_file_.option->needs( filter_max_coverage_quantile_.option );
+
+    // Add options for subsampling. Commands that write coverage distributions do not offer
+    // this, as those need to be based on the counts as read.
+    if( with_subsampling ) {
+        subsample_to_coverage_.option = sub->add_option(
+            "--subsample-to-coverage",
+            subsample_to_coverage_.value,
+            "Subsample the nucleotide counts of each sample at each position to this coverage, "
+            "by drawing reads without replacement (hypergeometric sampling), as is common "
+            "practice for example in PoPoolation, to get comparable diversity estimates across "
+            "samples and positions. This is done while reading the input, after the above "
+            "filters. Samples with a lower coverage at a position are masked, that is, their "
+            "counts are set to zero, and positions where all samples are masked are skipped. "
+            "With `--skip-invariant-positions`, positions that are invariant after subsampling "
+            "are skipped as well. The coverage distributions for "
+            "`--filter-max-coverage-quantile` are computed before subsampling."
+        );
+        subsample_to_coverage_.option->group( group );
+        subsample_seed_.option = sub->add_option(
+            "--subsample-seed",
+            subsample_seed_.value,
+            "Random seed for `--subsample-to-coverage`. The random numbers used for a position "
+            "only depend on the seed, the chromosome, and the position, so that results are "
+            "reproducible, independent of other filters and of the number of threads. If not "
+            "provided, the system clock is used to obtain a random seed."
+        );
+        subsample_seed_.option->group( group );
+        subsample_seed_.option->needs( subsample_to_coverage_.option );
+    }
+
+    // Add options for masking positions.
+    mask_bed_.option = sub->add_option(
+        "--mask-bed",
+        mask_bed_.value,
+        "BED file with intervals of positions to mask, such as repeats or regions of low "
+        "mappability. Masked positions are skipped when reading the input, and are not counted "
+        "towards the width of a window for the computation of coverage fractions."
+    );
+    mask_bed_.option->check( CLI::ExistingFile );
+    mask_bed_.option->group( group );
+    mask_fasta_.option = sub->add_option(
+        "--mask-fasta",
+        mask_fasta_.value,
+        "FASTA file with one sequence per chromosome, where each character represents a position; "
+        "`0` means that the position is used, while any other character masks the position, "
+        "with the same effect as `--mask-bed`. Can be combined with `--mask-bed`."
+    );
+    mask_fasta_.option->check( CLI::ExistingFile );
+    mask_fasta_.option->group( group );
+
+    // Add option to skip positions that are not variable. Commands that need all positions,
+    // for example as the denominator of per-window measures, do not offer this.
+    if( ! with_skip_invariant_positions ) {
+        return;
+    }
+    skip_invariant_positions_.option = sub->add_flag(
+        "--skip-invariant-positions",
+        skip_invariant_positions_.value,
+        "Skip positions that are invariant, that is, where at most one of the nucleotides `ACGT` "
+        "has non-zero counts in the samples (after applying the above count filters and the "
+        "sample filter). This is checked right after parsing the counts, and for sync input, "
+        "even directly on the input text if possible, and again after subsampling, if "
+        "`--subsample-to-coverage` is given. As most positions in a genome are "
+        "invariant, this can considerably speed up commands that only need SNPs; however, "
+        "the positions are then also not available for computing coverage statistics."
+    );
+    skip_invariant_positions_.option->group( group );
 }
 
 // -------------------------------------------------------------------------
@@ -437,10 +584,680 @@ FrequencyInputOptions::get_variant_sliding_window_iterator() const
     return make_sliding_window_iterator( settings, generator_.begin(), generator_.end() );
 }
 
+// -------------------------------------------------------------------------
+//     get_reference_genome
+// -------------------------------------------------------------------------
+
+std::shared_ptr<ReferenceGenome const> FrequencyInputOptions::get_reference_genome() const
+{
+    // Only open the file once, and only if needed. This just reads the index,
+    // the sequences are loaded lazily when accessed.
+    if( ! reference_genome_ && ! reference_genome_file_.value.empty() ) {
+        LOG_MSG2 << "Opening reference genome file " << reference_genome_file_.value;
+        reference_genome_ = std::make_shared<ReferenceGenome>( reference_genome_file_.value );
+    }
+    return reference_genome_;
+}
+
+// -------------------------------------------------------------------------
+//     get_genome_mask
+// -------------------------------------------------------------------------
+
+std::shared_ptr<GenomeMask const> FrequencyInputOptions::get_genome_mask() const
+{
+    // Only load the mask once, and only if needed.
+    auto const has_bed   = ! mask_bed_.value.empty();
+    auto const has_fasta = ! mask_fasta_.value.empty();
+    if( genome_mask_ || ( ! has_bed && ! has_fasta )) {
+        return genome_mask_;
+    }
+
+    auto mask = std::make_shared<GenomeMask>();
+    if( has_bed ) {
+        LOG_MSG2 << "Reading mask BED file " << mask_bed_.value;
+        mask->add_bed_file( mask_bed_.value );
+    }
+    if( has_fasta ) {
+        LOG_MSG2 << "Reading mask FASTA file " << mask_fasta_.value;
+        mask->add_fasta_file( mask_fasta_.value );
+    }
+    LOG_MSG2 << "Masking " << mask->masked_count() << " positions";
+    genome_mask_ = mask;
+    return genome_mask_;
+}
+
+// -------------------------------------------------------------------------
+//     skipped_position_count
+// -------------------------------------------------------------------------
+
+size_t FrequencyInputOptions::skipped_position_count() const
+{
+    return *skipped_positions_;
+}
+
+// -------------------------------------------------------------------------
+//     is_sync_passthrough_possible
+// -------------------------------------------------------------------------
+
+bool FrequencyInputOptions::is_sync_passthrough_possible() const
+{
+    // The region and sample filters, as well as skipping invariant positions, can be applied
+    // on the raw lines, but the count filters need to parse the counts, so that we cannot use
+    // the passthrough with them. Also, if a reference genome is given, we need to set the bases.
+    auto const has_count_filters = (
+        filter_min_coverage_.value > 0 || filter_max_coverage_.value > 0 ||
+        filter_min_allele_count_.value > 0 || filter_max_coverage_quantile_.value > 0.0 ||
+        subsample_to_coverage_.value > 0
+    );
+    auto const has_reference = ! reference_genome_file_.value.empty();
+    return sync_file_.option && *sync_file_.option && ! has_count_filters && ! has_reference;
+}
+
+// -------------------------------------------------------------------------
+//     write_sync_passthrough
+// -------------------------------------------------------------------------
+
+void FrequencyInputOptions::write_sync_passthrough( std::ostream& target ) const
+{
+    using namespace genesis;
+    using namespace genesis::population;
+    using namespace genesis::utils;
+
+    internal_check(
+        is_sync_passthrough_possible(),
+        "write_sync_passthrough() called with input that is not a sync file."
+    );
+
+    // Run the normal preparation first. This checks the input options and the file, and sets up
+    // the sample names. We do not use its iterator, but instead open the file again below.
+    prepare_data_();
+    auto const is_sample_filtered = (
+        ! filter_samples_include_.value.empty() || ! filter_samples_exclude_.value.empty()
+    );
+
+    // Get the number of samples in the file, and the indices of the ones that we want to keep.
+    // The member sample_names_ already is filtered, so we need to get all names again for this,
+    // for which we simply count the columns in the first line of the file.
+    std::string line;
+    InputStream first_input( from_file( sync_file_.value ));
+    first_input.get_line( line );
+    auto const column_count = static_cast<size_t>( std::count( line.begin(), line.end(), '\t' ));
+    internal_check( column_count >= 2, "Sync file became invalid." );
+    auto const sample_count = column_count - 2;
+    std::vector<size_t> sample_indices;
+    if( is_sample_filtered ) {
+        sample_indices = get_sample_filter_indices_(
+            get_sample_filter_( get_sync_sample_names_( sample_count ))
+        );
+    }
+    assert( ! is_sample_filtered || sample_indices.size() == sample_names_.size() );
+
+    // Prepare the region filter and the mask.
+    auto const is_region_filtered = ! filter_region_.value.empty();
+    auto const region = (
+        is_region_filtered ? parse_genome_region( filter_region_.value ) : GenomeRegion()
+    );
+    auto const mask = get_genome_mask();
+    GenomeMask::Bits const* mask_bits = nullptr;
+    std::string chromosome;
+
+    // Process the lines, re-using the buffers for the line and its columns.
+    std::vector<size_t> tabs;
+    size_t line_num = 0;
+    InputStream input( from_file( sync_file_.value ));
+    while( input ) {
+        line.clear();
+        input.get_line( line );
+        ++line_num;
+        if( line.empty() ) {
+            continue;
+        }
+
+        // Get the positions of the tabs that separate the columns. Sync files have three fixed
+        // columns (chromosome, position, reference base), so that the sample i starts after
+        // the tab at index 2 + i.
+        tabs.clear();
+        for( size_t i = 0; i < line.size(); ++i ) {
+            if( line[i] == '\t' ) {
+                tabs.push_back( i );
+            }
+        }
+        if( tabs.size() != sample_count + 2 ) {
+            throw std::runtime_error(
+                "Invalid sync file " + sync_file_.value + " with inconsistent number of samples "
+                "in line " + std::to_string( line_num )
+            );
+        }
+
+        // Apply the region filter and the mask, for which we need the chromosome and position.
+        bool use_line = true;
+        if( is_region_filtered || mask ) {
+            size_t position = 0;
+            for( size_t i = tabs[0] + 1; i < tabs[1]; ++i ) {
+                if( line[i] < '0' || line[i] > '9' ) {
+                    throw std::runtime_error(
+                        "Invalid sync file " + sync_file_.value + " with invalid position "
+                        "in line " + std::to_string( line_num )
+                    );
+                }
+                position = 10 * position + static_cast<size_t>( line[i] - '0' );
+            }
+
+            // Only copy the chromosome name and look up its mask when it changes.
+            if( line.compare( 0, tabs[0], chromosome ) != 0 ) {
+                chromosome.assign( line, 0, tabs[0] );
+                mask_bits = mask ? mask->chromosome_bits( chromosome ) : nullptr;
+            }
+            if( is_region_filtered ) {
+                use_line = is_covered( region, chromosome, position );
+            }
+            if( use_line && mask ) {
+                use_line = ! ( mask_bits && GenomeMask::is_masked( *mask_bits, position ));
+                *skipped_positions_ += static_cast<size_t>( ! use_line );
+            }
+        }
+
+        // Check that the position is variable in the samples that we keep, directly on the text.
+        if( use_line && skip_invariant_positions_.value ) {
+            use_line = is_sync_line_variable_( line, tabs, sample_indices, sample_count );
+            *skipped_positions_ += static_cast<size_t>( ! use_line );
+        }
+
+        // Write the line, either as a whole, or only the fixed columns and the kept samples.
+        if( use_line && ! is_sample_filtered ) {
+            target.write( line.data(), line.size() );
+            target.put( '\n' );
+        } else if( use_line ) {
+            target.write( line.data(), tabs[2] );
+            for( auto const index : sample_indices ) {
+                auto const begin = tabs[ 2 + index ];
+                auto const end = ( index + 1 < sample_count ) ? tabs[ 3 + index ] : line.size();
+                target.write( line.data() + begin, end - begin );
+            }
+            target.put( '\n' );
+        }
+    }
+}
+
+// -------------------------------------------------------------------------
+//     coverage_histogram_quantile
+// -------------------------------------------------------------------------
+
+size_t FrequencyInputOptions::coverage_histogram_quantile(
+    std::vector<size_t> const& histogram,
+    double quantile
+) {
+    size_t total = 0;
+    for( size_t c = 1; c < histogram.size(); ++c ) {
+        total += histogram[c];
+    }
+    if( total == 0 ) {
+        return 0;
+    }
+
+    // Find the first coverage at which the cumulative count reaches the quantile.
+    auto const target = quantile * static_cast<double>( total );
+    size_t cumulative = 0;
+    for( size_t c = 1; c < histogram.size(); ++c ) {
+        cumulative += histogram[c];
+        if( static_cast<double>( cumulative ) >= target ) {
+            return c;
+        }
+    }
+    return histogram.size() - 1;
+}
+
+// -------------------------------------------------------------------------
+//     write_coverage_histograms
+// -------------------------------------------------------------------------
+
+void FrequencyInputOptions::write_coverage_histograms(
+    std::ostream& target,
+    std::vector<std::string> const& sample_names,
+    std::vector<std::vector<size_t>> const& histograms
+) {
+    internal_check(
+        histograms.size() == sample_names.size(), "Invalid number of coverage histograms."
+    );
+
+    // Header, and then one row per coverage that occurs in any of the samples.
+    target << "COV";
+    for( auto const& name : sample_names ) {
+        target << "\t" << name;
+    }
+    target << "\n";
+    for( size_t c = 0; c < coverage_histogram_size; ++c ) {
+        bool any = false;
+        for( auto const& histogram : histograms ) {
+            internal_check(
+                histogram.size() == coverage_histogram_size, "Invalid coverage histogram size."
+            );
+            any |= ( histogram[c] > 0 );
+        }
+        if( ! any ) {
+            continue;
+        }
+        target << c;
+        for( auto const& histogram : histograms ) {
+            target << "\t" << histogram[c];
+        }
+        target << "\n";
+    }
+}
+
 // =================================================================================================
 //      Internal Helpers
 // =================================================================================================
 
+// -------------------------------------------------------------------------
+//     is_sync_line_variable_
+// -------------------------------------------------------------------------
+
+bool FrequencyInputOptions::is_sync_line_variable_(
+    std::string const& line,
+    std::vector<size_t> const& tabs,
+    std::vector<size_t> const& sample_indices,
+    size_t sample_count
+) const {
+    // Bit mask of the nucleotides with non-zero counts in the samples.
+    unsigned int bases = 0;
+    auto const check_sample_ = [&]( size_t index ){
+        // Each sample column has the format `A:T:C:G:N:DEL`. We only need to know which of the
+        // first four counts are non-zero, which is the case if they contain a non-zero digit.
+        // Masked samples are written as `.:.:.:.:.:.`, and hence never have any counts.
+        size_t pos = tabs[ 2 + index ] + 1;
+        auto const end = ( index + 1 < sample_count ) ? tabs[ 3 + index ] : line.size();
+        for( unsigned int field = 0; field < 4 && pos < end; ++field ) {
+            bool non_zero = false;
+            while( pos < end && line[pos] != ':' ) {
+                non_zero |= ( line[pos] >= '1' && line[pos] <= '9' );
+                ++pos;
+            }
+            bases |= non_zero ? ( 1u << field ) : 0u;
+            ++pos;
+        }
+    };
+    if( sample_indices.empty() ) {
+        for( size_t i = 0; i < sample_count; ++i ) {
+            check_sample_( i );
+        }
+    } else {
+        for( auto const index : sample_indices ) {
+            check_sample_( index );
+        }
+    }
+    return ( bases & ( bases - 1 )) != 0;
+}
+
+// -------------------------------------------------------------------------
+//     Count Filters
+// -------------------------------------------------------------------------
+
+/**
+ * @brief Settings for filtering the counts of the samples at each position.
+ *
+ * We keep them in a small struct, so that they can be captured by copy in the generator lambdas.
+ */
+struct VariantCountFilter
+{
+    size_t min_coverage     = 0;
+    size_t max_coverage     = 0;
+    size_t min_allele_count = 0;
+    bool   skip_invariant   = false;
+
+    // Per-sample maximum coverage, from the coverage quantile. Empty if not used.
+    std::vector<size_t> sample_max_coverages;
+
+    // Coverage to subsample to, or 0 if not used, and the seed for the random streams.
+    size_t        subsample_coverage = 0;
+    std::uint64_t subsample_seed     = 0;
+
+    // Mask of positions to skip, if given. We cache the bits of the current chromosome,
+    // which are set by the generator when the chromosome changes, see set_chromosome().
+    std::shared_ptr<GenomeMask const> mask;
+    mutable GenomeMask::Bits const* mask_bits = nullptr;
+
+    // Counter of the positions that were skipped, shared with the options.
+    std::shared_ptr<size_t> skipped_positions;
+
+    bool active() const
+    {
+        return has_coverage_filter() || skip_invariant || mask;
+    }
+
+    /**
+     * @brief Return whether any of the filters is set that masks samples by their counts.
+     *
+     * Without these, samples are never masked, and positions are only skipped by the genome mask
+     * or for being invariant.
+     */
+    bool has_coverage_filter() const
+    {
+        return min_coverage > 0 || max_coverage > 0 || min_allele_count > 0 ||
+            ! sample_max_coverages.empty() || subsample_coverage > 0;
+    }
+
+    /**
+     * @brief Set the @p chromosome of the following positions.
+     *
+     * This needs to be called whenever the chromosome of the input changes, so that the
+     * per-position checks do not need to compare chromosome names again.
+     */
+    void set_chromosome( std::string const& chromosome ) const
+    {
+        mask_bits = mask ? mask->chromosome_bits( chromosome ) : nullptr;
+    }
+
+    /**
+     * @brief Return whether a @p position on the current chromosome is masked.
+     */
+    bool is_masked( size_t position ) const
+    {
+        return mask_bits && GenomeMask::is_masked( *mask_bits, position );
+    }
+
+    /**
+     * @brief Get the coverage of a sample, only counting nucleotides that pass the allele count.
+     */
+    size_t coverage( genesis::population::BaseCounts const& sample ) const
+    {
+        auto const count_ = [&]( size_t count ){
+            return count >= min_allele_count ? count : 0;
+        };
+        return count_( sample.a_count ) + count_( sample.c_count ) +
+               count_( sample.g_count ) + count_( sample.t_count );
+    }
+
+    /**
+     * @brief Return whether a sample with the given @p index passes the coverage range.
+     */
+    bool passes( genesis::population::BaseCounts const& sample, size_t index ) const
+    {
+        auto const cov = coverage( sample );
+        auto const sample_max = sample_max_coverages.empty() ? 0 : sample_max_coverages[ index ];
+        return cov > 0 && cov >= min_coverage && cov >= subsample_coverage &&
+            ( max_coverage == 0 || cov <= max_coverage ) &&
+            ( sample_max == 0   || cov <= sample_max )
+        ;
+    }
+
+    /**
+     * @brief Get a bit mask of the nucleotides of a @p sample that have non-zero counts
+     * passing the minimum allele count.
+     */
+    unsigned int bases( genesis::population::BaseCounts const& sample ) const
+    {
+        unsigned int result = 0;
+        result |= ( sample.a_count >= min_allele_count && sample.a_count > 0 ) ? 1u : 0u;
+        result |= ( sample.c_count >= min_allele_count && sample.c_count > 0 ) ? 2u : 0u;
+        result |= ( sample.g_count >= min_allele_count && sample.g_count > 0 ) ? 4u : 0u;
+        result |= ( sample.t_count >= min_allele_count && sample.t_count > 0 ) ? 8u : 0u;
+        return result;
+    }
+
+    /**
+     * @brief Return whether a bit mask of @p bases has more than one nucleotide set.
+     */
+    static bool is_variable( unsigned int bases )
+    {
+        return ( bases & ( bases - 1 )) != 0;
+    }
+
+    /**
+     * @brief Return whether a Variant passes, that is, whether the position is used.
+     *
+     * This is the case if the position is not masked, any sample passes (if coverage filters are
+     * set), and, if invariant positions are skipped, at least two different nucleotides have
+     * non-zero counts in the passing samples. This works on the Variant as read by the parser, so that we can skip
+     * positions before copying them.
+     */
+    bool passes( genesis::population::Variant const& variant ) const
+    {
+        if( is_masked( variant.position )) {
+            return false;
+        }
+
+        // Bit mask of the nucleotides with non-zero counts in the samples that pass.
+        bool any_passes = false;
+        unsigned int variant_bases = 0;
+        for( size_t i = 0; i < variant.samples.size(); ++i ) {
+            auto const& sample = variant.samples[i];
+            if( ! passes( sample, i )) {
+                continue;
+            }
+            any_passes = true;
+            variant_bases |= bases( sample );
+        }
+        return ( any_passes || ! has_coverage_filter() ) &&
+            ( ! skip_invariant || is_variable( variant_bases ));
+    }
+
+    /**
+     * @brief Set low allele counts to zero, and mask samples that do not pass the coverage range,
+     * and subsample them, if needed.
+     *
+     * Masking sets the nucleotide counts of the sample to zero. The `N` and deletion counts are
+     * kept, as they are not part of the coverage, and are used by some of the output formats.
+     *
+     * Returns whether the position is still used. Subsampling can lose the rare alleles of a
+     * position that passed before, so that, if invariant positions are skipped, we check again
+     * afterwards.
+     */
+    bool apply( genesis::population::Variant& variant ) const
+    {
+        if( ! has_coverage_filter() ) {
+            return true;
+        }
+        for( size_t i = 0; i < variant.samples.size(); ++i ) {
+            auto& sample = variant.samples[i];
+            if( ! passes( sample, i )) {
+                sample.a_count = 0;
+                sample.c_count = 0;
+                sample.g_count = 0;
+                sample.t_count = 0;
+                continue;
+            }
+            auto const mask_ = [&]( size_t& count ){
+                count = count >= min_allele_count ? count : 0;
+            };
+            mask_( sample.a_count );
+            mask_( sample.c_count );
+            mask_( sample.g_count );
+            mask_( sample.t_count );
+        }
+        if( subsample_coverage == 0 ) {
+            return true;
+        }
+        subsample( variant );
+        if( ! skip_invariant ) {
+            return true;
+        }
+        unsigned int variant_bases = 0;
+        for( auto const& sample : variant.samples ) {
+            variant_bases |= bases( sample );
+        }
+        return is_variable( variant_bases );
+    }
+
+    /**
+     * @brief Subsample the nucleotide counts of all samples of a @p variant that have coverage
+     * to exactly the subsample coverage, using a random stream that is keyed by the position.
+     */
+    void subsample( genesis::population::Variant& variant ) const
+    {
+        // The stream is the position in the lower bits, and a hash of the chromosome (FNV-1a)
+        // in the upper bits, so that each position gets its own reproducible random numbers.
+        std::uint32_t chr_hash = 2166136261u;
+        for( auto const c : variant.chromosome ) {
+            chr_hash = ( chr_hash ^ static_cast<unsigned char>( c )) * 16777619u;
+        }
+        auto const stream = ( static_cast<std::uint64_t>( chr_hash ) << 32 ) ^ variant.position;
+        PhiloxEngine engine( subsample_seed, stream );
+
+        for( auto& sample : variant.samples ) {
+            auto const cov = sample.a_count + sample.c_count + sample.g_count + sample.t_count;
+            if( cov == 0 ) {
+                continue;
+            }
+            assert( cov >= subsample_coverage );
+            std::array<size_t, 4> counts = {{
+                sample.a_count, sample.c_count, sample.g_count, sample.t_count
+            }};
+            counts = draw_hypergeometric( engine, counts, cov, subsample_coverage );
+            sample.a_count = counts[0];
+            sample.c_count = counts[1];
+            sample.g_count = counts[2];
+            sample.t_count = counts[3];
+        }
+    }
+
+    /**
+     * @brief Draw @p n reads without replacement from the reads given by the @p counts
+     * of each nucleotide, which sum to @p total, and return the counts of the drawn reads.
+     *
+     * We draw the counts of the nucleotides one after another, each from the hypergeometric
+     * distribution conditional on the counts drawn before, so that this needs a constant
+     * expected number of random numbers, independent of the coverage.
+     */
+    static std::array<size_t, 4> draw_hypergeometric(
+        PhiloxEngine& engine, std::array<size_t, 4> const& counts, size_t total, size_t n
+    ) {
+        std::array<size_t, 4> drawn = {{ 0, 0, 0, 0 }};
+        auto remaining = total;
+        for( size_t k = 0; k < 3 && n > 0; ++k ) {
+            assert( counts[k] <= remaining );
+            drawn[k] = hypergeometric_variate( engine, counts[k], remaining - counts[k], n );
+            remaining -= counts[k];
+            n -= drawn[k];
+        }
+        assert( n <= counts[3] );
+        drawn[3] = n;
+        return drawn;
+    }
+};
+
+/**
+ * @brief Set the reference base of a @p variant, and if needed, its alternative base.
+ *
+ * If the alternative base is not a different nucleotide than the new reference base, we use
+ * the most common other nucleotide of the samples instead, as the input file might have used
+ * a different reference base to determine it.
+ */
+void set_reference_base_( genesis::population::Variant& variant, char reference_base )
+{
+    using namespace genesis::population;
+
+    variant.reference_base = reference_base;
+    auto const is_acgt_ = []( char c ){
+        return c == 'A' || c == 'C' || c == 'G' || c == 'T';
+    };
+    if( is_acgt_( reference_base ) && (
+        variant.alternative_base == reference_base || ! is_acgt_( variant.alternative_base )
+    )) {
+        // Sorted with the reference base first, so that the second one is the alternative.
+        auto const order = sorted_variant_counts( variant, true );
+        variant.alternative_base = order[1].first;
+    }
+}
+
+/**
+ * @brief Create a generator of Variant%s from a range of input elements.
+ *
+ * The @p convert function turns the input elements into Variant%s. If the count @p filter is
+ * active, positions where no sample passes are skipped before the Variant is copied for the
+ * generator, and the samples of the remaining ones are masked and subsampled as needed, skipping
+ * positions that became invariant by that. Skipped positions are counted in the filter.
+ * If a @p reference genome is given, the reference bases of the Variant%s are set from it.
+ *
+ * The chromosome name is compared once per position, to detect when it changes. The mask bits
+ * of the filter and the reference sequence are then looked up once per chromosome.
+ */
+template<class InputIterator, class Conversion>
+genesis::utils::LambdaIteratorGenerator<genesis::population::Variant> make_variant_generator_(
+    InputIterator begin, InputIterator end, Conversion convert, VariantCountFilter const& filter,
+    std::shared_ptr<ReferenceGenome const> reference
+) {
+    using namespace genesis::population;
+
+    // Current chromosome, and the reference sequence for it, to avoid looking it up by name.
+    // The first position always counts as a new chromosome, even if its name is empty.
+    std::string chromosome;
+    bool first = true;
+    ReferenceGenome::Sequence const* ref_sequence = nullptr;
+
+    // Use a lambda capture by mutable value, so that the iterators are kept alive in the generator.
+    return genesis::utils::LambdaIteratorGenerator<Variant>(
+        [ begin, end, convert, filter, reference, chromosome, first, ref_sequence ]()
+        mutable -> std::shared_ptr<Variant>{
+            while( begin != end ) {
+                auto&& variant = convert( *begin );
+                if( first || variant.chromosome != chromosome ) {
+                    chromosome = variant.chromosome;
+                    first = false;
+                    filter.set_chromosome( chromosome );
+                    if( reference ) {
+                        ref_sequence = reference->get_sequence( chromosome );
+                    }
+                }
+                if( filter.active() && ! filter.passes( variant )) {
+                    ++*filter.skipped_positions;
+                    ++begin;
+                    continue;
+                }
+                auto res = std::make_shared<Variant>( std::forward<decltype(variant)>( variant ));
+                ++begin;
+                if( filter.active() && ! filter.apply( *res )) {
+                    ++*filter.skipped_positions;
+                    continue;
+                }
+                if( reference ) {
+                    set_reference_base_(
+                        *res, ref_sequence ? reference->get_base( *ref_sequence, res->position ) : 'N'
+                    );
+                }
+                return res;
+            }
+            return nullptr;
+        }
+    );
+}
+
+VariantCountFilter FrequencyInputOptions::get_count_filter_() const
+{
+    VariantCountFilter filter;
+    filter.min_coverage     = filter_min_coverage_.value;
+    filter.max_coverage     = filter_max_coverage_.value;
+    filter.min_allele_count = filter_min_allele_count_.value;
+    filter.skip_invariant   = skip_invariant_positions_.value;
+    filter.skipped_positions = skipped_positions_;
+    filter.mask = get_genome_mask();
+    filter.sample_max_coverages = sample_max_coverages_;
+
+    // For subsampling, we need a seed. If not given, we use the clock once, and report it,
+    // so that the run can be reproduced.
+    // We do not subsample in the pass that computes the coverage distributions for the maximum
+    // coverage quantile, as otherwise all of them would just be the subsample coverage.
+    filter.subsample_coverage = coverage_histogram_pass_ ? 0 : subsample_to_coverage_.value;
+    if( filter.subsample_coverage > 0 ) {
+        if( subsample_seed_.option && *subsample_seed_.option ) {
+            subsample_seed_used_ = subsample_seed_.value;
+        } else if( subsample_seed_used_ == 0 ) {
+            subsample_seed_used_ = static_cast<std::uint64_t>(
+                std::chrono::system_clock::now().time_since_epoch().count()
+            );
+            LOG_MSG << "Using random seed " << subsample_seed_used_ << " for subsampling";
+        }
+        filter.subsample_seed = subsample_seed_used_;
+    }
+    if( filter.max_coverage > 0 && filter.min_coverage > filter.max_coverage ) {
+        throw CLI::ValidationError(
+            filter_min_coverage_.option->get_name() + ", " + filter_max_coverage_.option->get_name(),
+            "Invalid coverage range, with minimum coverage greater than the maximum coverage."
+        );
+    }
+    return filter;
+}
+
 // -------------------------------------------------------------------------
 //     prepare_data_
 // -------------------------------------------------------------------------
@@ -493,15 +1310,206 @@ void FrequencyInputOptions::prepare_data_() const
     // meaning there is some incidental code duplication (or at least, very similar code blocks)
     // in the functions below... :-(
 
-    if( pileup_file_.option && *pileup_file_.option ) {
-        prepare_data_pileup_();
+    // If the maximum coverage is given as a quantile, we first set up the iterator for a pass
+    // over the input to get the coverage distributions. Then, we set it up again, this time with
+    // the per-sample maximum coverage filter, and with subsampling.
+    auto const use_quantile = ( filter_max_coverage_quantile_.value > 0.0 );
+    coverage_histogram_pass_ = use_quantile;
+    auto prepare_format_ = [&](){
+        if( pileup_file_.option && *pileup_file_.option ) {
+            prepare_data_pileup_();
+        }
+        if( sync_file_.option && *sync_file_.option ) {
+            prepare_data_sync_();
+        }
+        if( vcf_file_.option && *vcf_file_.option ) {
+            prepare_data_vcf_();
+        }
+    };
+    prepare_format_();
+
+    if( use_quantile ) {
+        compute_sample_max_coverages_();
+        coverage_histogram_pass_ = false;
+        *skipped_positions_ = 0;
+        generator_ = LambdaIteratorGenerator<Variant>();
+        sample_names_.clear();
+        prepare_format_();
+    }
+}
+
+// -------------------------------------------------------------------------
+//     compute_sample_max_coverages_
+// -------------------------------------------------------------------------
+
+void FrequencyInputOptions::compute_sample_max_coverages_() const
+{
+    using namespace genesis;
+    using namespace genesis::population;
+    using namespace genesis::utils;
+
+    // Get the coverage histograms, either from the file, or from a pass over the input.
+    std::vector<std::vector<size_t>> histograms;
+    auto const& stats_file = coverage_stats_file_.value;
+    if( ! stats_file.empty() && file_exists( stats_file )) {
+        LOG_MSG << "Reading coverage distributions from " << stats_file;
+        histograms = read_coverage_histograms_( stats_file );
+    } else {
+        LOG_MSG << "Computing coverage distributions of all samples";
+        histograms = compute_coverage_histograms_();
+        if( ! stats_file.empty() ) {
+            write_coverage_histograms_( stats_file, histograms );
+        }
+    }
+    internal_check(
+        histograms.size() == sample_names_.size(), "Invalid number of coverage histograms."
+    );
+
+    // Get the quantile of each sample. We only consider positions with non-zero coverage here,
+    // as zero coverage is not informative, and would just shift the quantiles. Samples without
+    // any coverage get 0, that is, no maximum.
+    sample_max_coverages_.resize( histograms.size() );
+    for( size_t i = 0; i < histograms.size(); ++i ) {
+        auto const& histogram = histograms[i];
+
+        // If the quantile is in the last bin, which also counts all higher coverages, we cannot
+        // determine the actual value, and use no maximum instead.
+        auto max_coverage = coverage_histogram_quantile(
+            histogram, filter_max_coverage_quantile_.value
+        );
+        if( max_coverage + 1 >= histogram.size() ) {
+            LOG_WARN << "Warning: Coverage quantile of sample " << sample_names_[i]
+                     << " is above the maximum of the coverage distribution; "
+                     << "no maximum coverage is applied to this sample.";
+            max_coverage = 0;
+        }
+        sample_max_coverages_[i] = max_coverage;
+        LOG_MSG2 << "Maximum coverage of sample " << sample_names_[i] << ": " << max_coverage;
+    }
+}
+
+// -------------------------------------------------------------------------
+//     compute_coverage_histograms_
+// -------------------------------------------------------------------------
+
+std::vector<std::vector<size_t>> FrequencyInputOptions::compute_coverage_histograms_() const
+{
+    using namespace genesis::population;
+
+    // We read the input in batches, and then count the coverages of the samples in parallel.
+    // The coverage is computed after the other filters, but without subsampling (see
+    // get_count_filter_()), so we simply sum up the counts.
+    auto const sample_count = sample_names_.size();
+    auto histograms = std::vector<std::vector<size_t>>(
+        sample_count, std::vector<size_t>( coverage_histogram_size, 0 )
+    );
+    auto const max_bin = coverage_histogram_size - 1;
+    std::vector<Variant> batch;
+    size_t batch_used = 0;
+    auto process_batch_ = [&](){
+        #pragma omp parallel for
+        for( size_t i = 0; i < sample_count; ++i ) {
+            auto& histogram = histograms[i];
+            for( size_t j = 0; j < batch_used; ++j ) {
+                auto const& sample = batch[j].samples[i];
+                auto const cov = sample.a_count + sample.c_count + sample.g_count + sample.t_count;
+                ++histogram[ std::min( cov, max_bin ) ];
+            }
+        }
+        batch_used = 0;
+    };
+
+    for( auto const& variant : generator_ ) {
+        if( variant.samples.size() != sample_count ) {
+            throw std::runtime_error(
+                "Input has inconsistent number of samples at " + variant.chromosome + ":" +
+                std::to_string( variant.position )
+            );
+        }
+        if( batch_used < batch.size() ) {
+            batch[ batch_used ] = variant;
+        } else {
+            batch.push_back( variant );
+        }
+        ++batch_used;
+        if( batch_used == 4096 ) {
+            process_batch_();
+        }
+    }
+    process_batch_();
+    return histograms;
+}
+
+// -------------------------------------------------------------------------
+//     read_coverage_histograms_
+// -------------------------------------------------------------------------
+
+std::vector<std::vector<size_t>> FrequencyInputOptions::read_coverage_histograms_(
+    std::string const& file
+) const {
+    using namespace genesis::utils;
+
+    // Read the header, and find the columns of our samples.
+    InputStream input( from_file( file ));
+    std::string line;
+    input.get_line( line );
+    auto const header = split( line, "\t", false );
+    if( header.empty() || header[0] != "COV" ) {
+        throw std::runtime_error( "Invalid coverage stats file " + file );
     }
-    if( sync_file_.option && *sync_file_.option ) {
-        prepare_data_sync_();
+    std::vector<size_t> columns;
+    for( auto const& name : sample_names_ ) {
+        auto const it = std::find( header.begin() + 1, header.end(), name );
+        if( it == header.end() ) {
+            throw std::runtime_error(
+                "Coverage stats file " + file + " does not contain sample " + name
+            );
+        }
+        columns.push_back( static_cast<size_t>( it - header.begin() ));
     }
-    if( vcf_file_.option && *vcf_file_.option ) {
-        prepare_data_vcf_();
+
+    // Read the counts of each coverage.
+    auto histograms = std::vector<std::vector<size_t>>(
+        sample_names_.size(), std::vector<size_t>( coverage_histogram_size, 0 )
+    );
+    while( input ) {
+        line.clear();
+        input.get_line( line );
+        if( line.empty() ) {
+            continue;
+        }
+        auto const fields = split( line, "\t", false );
+        if( fields.size() != header.size() ) {
+            throw std::runtime_error( "Invalid coverage stats file " + file );
+        }
+        try {
+            auto const cov = std::min<size_t>(
+                std::stoull( fields[0] ), coverage_histogram_size - 1
+            );
+            for( size_t i = 0; i < columns.size(); ++i ) {
+                histograms[i][cov] += std::stoull( fields[ columns[i] ] );
+            }
+        } catch( std::logic_error const& ) {
+            throw std::runtime_error( "Invalid coverage stats file " + file );
+        }
     }
+    return histograms;
+}
+
+// -------------------------------------------------------------------------
+//     write_coverage_histograms_
+// -------------------------------------------------------------------------
+
+void FrequencyInputOptions::write_coverage_histograms_(
+    std::string const& file,
+    std::vector<std::vector<size_t>> const& histograms
+) const {
+    LOG_MSG << "Writing coverage distributions to " << file;
+    std::ofstream os( file );
+    if( ! os ) {
+        throw std::runtime_error( "Cannot write coverage stats file " + file );
+    }
+    write_coverage_histograms( os, sample_names_, histograms );
 }
 
 // -------------------------------------------------------------------------
@@ -591,19 +1599,14 @@ void FrequencyInputOptions::prepare_data_pileup_() const
         sample_names_ = get_sample_name_subset_( sample_names_, sample_filter );
     }
 
-    // Apply region filter if necessary.
+    // Apply region filter if necessary, and create a generator that reads pileup.
+    // The count filters are applied in the generator itself.
+    auto const convert = []( Variant const& variant ) -> Variant const& {
+        return variant;
+    };
     if( filter_region_.value.empty() ) {
-        // Create a generator that reads pileup.
-        generator_ = LambdaIteratorGenerator<Variant>(
-            [ it ]() mutable -> std::shared_ptr<Variant>{
-                if( it ) {
-                    auto res = std::make_shared<Variant>( *it );
-                    ++it;
-                    return res;
-                } else {
-                    return nullptr;
-                }
-            }
+        generator_ = make_variant_generator_(
+            it, VariantPileupInputIterator(), convert, get_count_filter_(), get_reference_genome()
         );
     } else {
         auto const region = parse_genome_region( filter_region_.value );
@@ -614,20 +1617,9 @@ void FrequencyInputOptions::prepare_data_pileup_() const
             // Use the iterator and a default constructed dummy as begin and end.
             it, VariantPileupInputIterator()
         );
-
-        // Create a generator that reads pileup and filters by region.
-        auto beg = region_filtered_range.begin();
-        auto end = region_filtered_range.end();
-        generator_ = LambdaIteratorGenerator<Variant>(
-            [ beg, end ]() mutable -> std::shared_ptr<Variant>{
-                if( beg != end ) {
-                    auto res = std::make_shared<Variant>( *beg );
-                    ++beg;
-                    return res;
-                } else {
-                    return nullptr;
-                }
-            }
+        generator_ = make_variant_generator_(
+            region_filtered_range.begin(), region_filtered_range.end(),
+            convert, get_count_filter_(), get_reference_genome()
         );
     }
 }
@@ -665,20 +1657,7 @@ void FrequencyInputOptions::prepare_data_sync_() const
         );
     }
     auto const smp_cnt = it->samples.size();
-    if( sample_name_list_.option && *sample_name_list_.option ) {
-        sample_names_ = get_sample_name_list_( sample_name_list_.value );
-        if( sample_names_.size() != smp_cnt ) {
-            throw CLI::ValidationError(
-                sample_name_list_.option->get_name() + "(" + sample_name_list_.value + ")",
-                "Invalid sample names list that contains a different number of names than "
-                "the sync file has samples."
-            );
-        }
-    } else {
-        for( size_t i = 0; i < smp_cnt; ++i ) {
-            sample_names_.push_back( sample_name_prefix_.value + std::to_string(i+1) );
-        }
-    }
+    sample_names_ = get_sync_sample_names_( smp_cnt );
     assert( sample_names_.size() == smp_cnt );
 
     // Filter sample names as needed. This is a bit cumbersome, but gets the job done.
@@ -699,19 +1678,14 @@ void FrequencyInputOptions::prepare_data_sync_() const
         sample_names_ = get_sample_name_subset_( sample_names_, sample_filter );
     }
 
-    // Apply region filter if necessary.
+    // Apply region filter if necessary, and create a generator that reads sync.
+    // The count filters are applied in the generator itself.
+    auto const convert = []( Variant const& variant ) -> Variant const& {
+        return variant;
+    };
     if( filter_region_.value.empty() ) {
-        // Create a generator that reads pileup.
-        generator_ = LambdaIteratorGenerator<Variant>(
-            [it]() mutable -> std::shared_ptr<Variant>{
-                if( it ) {
-                    auto res = std::make_shared<Variant>( *it );
-                    ++it;
-                    return res;
-                } else {
-                    return nullptr;
-                }
-            }
+        generator_ = make_variant_generator_(
+            it, SyncInputIterator(), convert, get_count_filter_(), get_reference_genome()
         );
     } else {
         auto const region = parse_genome_region( filter_region_.value );
@@ -722,24 +1696,37 @@ void FrequencyInputOptions::prepare_data_sync_() const
             // Use the iterator and a default constructed dummy as begin and end.
             it, SyncInputIterator()
         );
-
-        // Create a generator that reads pileup and filters by region.
-        auto beg = region_filtered_range.begin();
-        auto end = region_filtered_range.end();
-        generator_ = LambdaIteratorGenerator<Variant>(
-            [beg, end]() mutable -> std::shared_ptr<Variant>{
-                if( beg != end ) {
-                    auto res = std::make_shared<Variant>( *beg );
-                    ++beg;
-                    return res;
-                } else {
-                    return nullptr;
-                }
-            }
+        generator_ = make_variant_generator_(
+            region_filtered_range.begin(), region_filtered_range.end(),
+            convert, get_count_filter_(), get_reference_genome()
         );
     }
 }
 
+// -------------------------------------------------------------------------
+//     get_sync_sample_names_
+// -------------------------------------------------------------------------
+
+std::vector<std::string> FrequencyInputOptions::get_sync_sample_names_( size_t sample_count ) const
+{
+    std::vector<std::string> result;
+    if( sample_name_list_.option && *sample_name_list_.option ) {
+        result = get_sample_name_list_( sample_name_list_.value );
+        if( result.size() != sample_count ) {
+            throw CLI::ValidationError(
+                sample_name_list_.option->get_name() + "(" + sample_name_list_.value + ")",
+                "Invalid sample names list that contains a different number of names than "
+                "the sync file has samples."
+            );
+        }
+    } else {
+        for( size_t i = 0; i < sample_count; ++i ) {
+            result.push_back( sample_name_prefix_.value + std::to_string(i+1) );
+        }
+    }
+    return result;
+}
+
 // -------------------------------------------------------------------------
 //     prepare_data_vcf_
 // -------------------------------------------------------------------------
@@ -787,11 +1774,12 @@ void FrequencyInputOptions::prepare_data_vcf_() const
     }, vcf_in, {} );
 
     // Apply region filter if necessary.
+    // The VCF records are converted to Variants in the generator, which also applies
+    // the count filters.
+    auto const convert = []( VcfRecord const& record ){
+        return convert_to_variant( record );
+    };
     if( filter_region_.value.empty() ) {
-        // Need variables that can be captures by copy...
-        auto beg = vcf_range.begin();
-        auto end = vcf_range.end();
-
         // Create an iterator that erases the type (which here is a complex templated type with
         // the VcfInputIterator and FilterIterator and all that). We use a lambda capture by
         // mutable value, so that the actual iterator is stored (as a copy, but that works) in the
@@ -803,16 +1791,8 @@ void FrequencyInputOptions::prepare_data_vcf_() const
         // copy of the iterator (`vcf_in`), but the thread would still want to use it...
         // That took a while to figure out, and is fixed now by having the thread pool keep copies
         // of the internal members of VcfFormatIterator of its own.
-        generator_ = LambdaIteratorGenerator<Variant>(
-            [beg, end]() mutable -> std::shared_ptr<Variant>{
-                if( beg != end ) {
-                    auto res = std::make_shared<Variant>( convert_to_variant(*beg) );
-                    ++beg;
-                    return res;
-                } else {
-                    return nullptr;
-                }
-            }
+        generator_ = make_variant_generator_(
+            vcf_range.begin(), vcf_range.end(), convert, get_count_filter_(), get_reference_genome()
         );
     } else {
         auto const region = parse_genome_region( filter_region_.value );
@@ -822,20 +1802,9 @@ void FrequencyInputOptions::prepare_data_vcf_() const
             },
             vcf_range.begin(), vcf_range.end()
         );
-
-        // Create a generator that reads pileup and filters by region.
-        auto beg = region_filtered_range.begin();
-        auto end = region_filtered_range.end();
-        generator_ = LambdaIteratorGenerator<Variant>(
-            [beg, end]() mutable -> std::shared_ptr<Variant>{
-                if( beg != end ) {
-                    auto res = std::make_shared<Variant>( convert_to_variant(*beg) );
-                    ++beg;
-                    return res;
-                } else {
-                    return nullptr;
-                }
-            }
+        generator_ = make_variant_generator_(
+            region_filtered_range.begin(), region_filtered_range.end(),
+            convert, get_count_filter_(), get_reference_genome()
         );
     }
 }
@@ -27,6 +27,8 @@
 #include "CLI/CLI.hpp"
 
 #include "tools/cli_option.hpp"
+#include "tools/genome_mask.hpp"
+#include "tools/reference_genome.hpp"
 
 #include "genesis/population/variant.hpp"
 #include "genesis/population/window/sliding_window_iterator.hpp"
@@ -34,11 +36,17 @@
 #include "genesis/utils/containers/lambda_iterator.hpp"
 #include "genesis/utils/containers/range.hpp"
 
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <iosfwd>
 #include <string>
 #include <utility>
 #include <vector>
 
+// Forward declaration of the filter settings for the counts, only used internally.
+struct VariantCountFilter;
+
 // =================================================================================================
 //      Frequency Input Options
 // =================================================================================================
@@ -105,8 +113,19 @@ public:
         std::string const& group = "Input"
     );
 
+    /**
+     * @brief Add the filter options to the app.
+     *
+     * Commands that need to see all positions, for example because they use the number of
+     * positions in a window, set @p with_skip_invariant_positions to `false`, so that the
+     * user cannot drop the invariant positions. Similarly, commands that write coverage
+     * distributions set @p with_subsampling to `false`, as subsampling would set all
+     * coverages to the same value.
+     */
     void add_filter_opts_to_app(
         CLI::App* sub,
+        bool with_skip_invariant_positions = true,
+        bool with_subsampling = true,
         std::string const& group = "Filtering"
     );
 
@@ -135,6 +154,32 @@ public:
      */
     std::pair<size_t, size_t> get_window_width_and_stride() const;
 
+    /**
+     * @brief Get the reference genome given by `--reference-genome`, or `nullptr` if not given.
+     *
+     * The reference bases of the positions in the iterators are already set from this. It can be
+     * used to get the chromosome lengths, or the number of callable positions in a window.
+     */
+    std::shared_ptr<ReferenceGenome const> get_reference_genome() const;
+
+    /**
+     * @brief Get the mask of positions given by `--mask-bed` and `--mask-fasta`,
+     * or `nullptr` if no mask was given.
+     *
+     * The mask is already applied when reading the input, so that masked positions never appear
+     * in the iterators. It can be used to get the number of masked positions in a window.
+     */
+    std::shared_ptr<GenomeMask const> get_genome_mask() const;
+
+    /**
+     * @brief Get the number of positions that were skipped so far by the count filters,
+     * the mask, and by `--skip-invariant-positions`.
+     *
+     * This is meant to be called after iterating the input, for example to account for the total
+     * number of positions in the input, or for user output.
+     */
+    size_t skipped_position_count() const;
+
     // -------------------------------------
     //     Iteration
     // -------------------------------------
@@ -173,13 +218,88 @@ public:
     >
     get_variant_sliding_window_iterator() const;
 
+    // -------------------------------------
+    //     Raw Sync Passthrough
+    // -------------------------------------
+
+    /**
+     * @brief Return whether the input can be passed through as raw sync lines.
+     *
+     * This is the case if the input is a sync file, so that its lines can be copied to a sync
+     * output without parsing the counts, only applying the region and sample filters, the mask,
+     * and skipping invariant positions. This is not possible with the count filters, or if
+     * a reference genome is given.
+     */
+    bool is_sync_passthrough_possible() const;
+
+    /**
+     * @brief Copy the lines of a sync input file to a @p target, applying the region and
+     * sample filters, without parsing the counts into Variant%s.
+     *
+     * Lines that pass the region filter are either copied as-is, or, if samples are filtered,
+     * reduced to the columns of the samples that are kept.
+     */
+    void write_sync_passthrough( std::ostream& target ) const;
+
+    // -------------------------------------
+    //     Coverage Histograms
+    // -------------------------------------
+
+    /**
+     * @brief Number of entries of the coverage histograms, that is, the per-sample counts
+     * of positions with each coverage. The last entry counts all higher coverages as well.
+     */
+    static const size_t coverage_histogram_size = 65536;
+
+    /**
+     * @brief Write coverage histograms in the format of the `--coverage-stats-file`.
+     *
+     * The table has a column per sample, and a row per coverage that occurs in any sample,
+     * counting the positions with that coverage.
+     */
+    static void write_coverage_histograms(
+        std::ostream& target,
+        std::vector<std::string> const& sample_names,
+        std::vector<std::vector<size_t>> const& histograms
+    );
+
+    /**
+     * @brief Get the smallest coverage of a @p histogram for which the fraction @p quantile
+     * of the covered positions (coverage greater than zero) has at most this coverage.
+     *
+     * Returns 0 if there are no covered positions. If the quantile falls into the last entry,
+     * which also counts all higher coverages, its index `histogram.size() - 1` is returned.
+     */
+    static size_t coverage_histogram_quantile(
+        std::vector<size_t> const& histogram,
+        double quantile
+    );
+
     // -------------------------------------------------------------------------
     //     Internal Helpers
     // -------------------------------------------------------------------------
 
 private:
 
+    /**
+     * @brief Get the settings of the count filters, for use in the generators.
+     */
+    VariantCountFilter get_count_filter_() const;
+
     void prepare_data_() const;
+
+    /**
+     * @brief Set the per-sample maximum coverages from the coverage quantile, using the coverage
+     * distributions of the samples, either read from the stats file, or computed in a pass over
+     * the input iterator.
+     */
+    void compute_sample_max_coverages_() const;
+    std::vector<std::vector<size_t>> compute_coverage_histograms_() const;
+    std::vector<std::vector<size_t>> read_coverage_histograms_( std::string const& file ) const;
+    void write_coverage_histograms_(
+        std::string const& file,
+        std::vector<std::vector<size_t>> const& histograms
+    ) const;
     void prepare_data_pileup_() const;
     void prepare_data_sync_() const;
     void prepare_data_vcf_() const;
@@ -192,6 +312,23 @@ private:
      */
     std::vector<std::string> get_sample_name_list_( std::string const& list ) const;
 
+    /**
+     * @brief Get the names of all samples in a sync file with the given number of samples,
+     * either from the sample name list, or using the sample name prefix and the sample number.
+     */
+    std::vector<std::string> get_sync_sample_names_( size_t sample_count ) const;
+
+    /**
+     * @brief Check whether a sync @p line is variable in the samples given by @p sample_indices,
+     * or in all samples if the indices are empty, using the positions of the @p tabs in the line.
+     */
+    bool is_sync_line_variable_(
+        std::string const& line,
+        std::vector<size_t> const& tabs,
+        std::vector<size_t> const& sample_indices,
+        size_t sample_count
+    ) const;
+
     /**
      * @brief Subset a sample names list by only returning a list of sample names for which
      * the bool vector is true. Both vectors hence need to have the same size.
@@ -232,12 +369,29 @@ private:
     CliOption<std::string> vcf_file_    = "";
     CliOption<std::string> sample_name_list_ = "";
     CliOption<std::string> sample_name_prefix_ = ""; // "Sample_"
+    CliOption<std::string> reference_genome_file_ = "";
 
     // Filters for rows and columns
     CliOption<std::string> filter_region_ = "";
     CliOption<std::string> filter_samples_include_ = "";
     CliOption<std::string> filter_samples_exclude_ = "";
 
+    // Filters for the counts of each position
+    CliOption<size_t> filter_min_coverage_     = 0;
+    CliOption<size_t> filter_max_coverage_     = 0;
+    CliOption<size_t> filter_min_allele_count_ = 0;
+    CliOption<double> filter_max_coverage_quantile_ = 0.0;
+    CliOption<std::string> coverage_stats_file_ = "";
+
+    // Subsampling of the counts
+    CliOption<size_t>        subsample_to_coverage_ = 0;
+    CliOption<std::uint64_t> subsample_seed_ = 0;
+    CliOption<bool>   skip_invariant_positions_ = false;
+
+    // Genome mask files
+    CliOption<std::string> mask_bed_   = "";
+    CliOption<std::string> mask_fasta_ = "";
+
     // Window settings
     CliOption<size_t> window_width_  = 1000;
     CliOption<size_t> window_stride_ = 0;
@@ -252,6 +406,26 @@ private:
     // Not all formats have sample names, so we need to cache those.
     mutable std::vector<std::string> sample_names_;
 
+    // Seed used for subsampling, either given, or from the clock, fixed once it is set.
+    mutable std::uint64_t subsample_seed_used_ = 0;
+
+    // Per-sample maximum coverage, set from the coverage quantile, if given.
+    mutable std::vector<size_t> sample_max_coverages_;
+
+    // Set during the pass over the input that computes the coverage distributions, so that these
+    // are based on the counts as read, instead of the subsampled ones.
+    mutable bool coverage_histogram_pass_ = false;
+
+    // The reference genome, if given, opened once when first needed.
+    mutable std::shared_ptr<ReferenceGenome const> reference_genome_;
+
+    // The mask, if given, loaded once when first needed.
+    mutable std::shared_ptr<GenomeMask const> genome_mask_;
+
+    // Number of positions skipped by the filters. We use a pointer, so that the generator can
+    // keep counting independently of copies of this object.
+    std::shared_ptr<size_t> skipped_positions_ = std::make_shared<size_t>( 0 );
+
 };
 
 #endif // include guard
@@ -64,6 +64,11 @@ void PoolsizesOptions::add_poolsizes_opt_to_app(
 //      Run Functions
 // =================================================================================================
 
+bool PoolsizesOptions::provided() const
+{
+    return poolsizes.option && *poolsizes.option;
+}
+
 std::vector<size_t> PoolsizesOptions::get_pool_sizes(
     std::vector<std::string> const& sample_names,
     std::vector<bool> const& sample_filter
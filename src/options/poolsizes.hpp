@@ -74,6 +74,13 @@ public:
     //     Run Functions
     // -------------------------------------------------------------------------
 
+    /**
+     * @brief Return whether pool sizes were provided by the user.
+     *
+     * This is useful for commands where the pool sizes are optional.
+     */
+    bool provided() const;
+
     /**
      * @brief Get the pool sizes for the given samples, optionally filtered.
      *
@@ -0,0 +1,163 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "options/sample_pairs.hpp"
+
+#include "options/global.hpp"
+#include "tools/misc.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// =================================================================================================
+//      Setup Functions
+// =================================================================================================
+
+void SamplePairsOptions::add_sample_pairs_opts_to_app(
+    CLI::App* sub,
+    std::string const& measure,
+    std::string const& group
+) {
+    // Correct setup check.
+    internal_check(
+        comparand.option == nullptr,
+        "Cannot use the same SamplePairsOptions object multiple times."
+    );
+
+    // Settings: Comparand
+    comparand.option = sub->add_option(
+        "--comparand",
+        comparand.value,
+        "By default, " + measure + " between all pairs of samples (that are not filtered) is "
+        "computed. If this option is given a sample name however, only the pairwise " + measure +
+        " between that sample and all others (that are not filtered) is computed."
+    );
+    comparand.option->group( group );
+
+    // Settings: Second comparand
+    second_comparand.option = sub->add_option(
+        "--second-comparand",
+        second_comparand.value,
+        "If in addition to `--comparand`, this option is also given a (second) sample name, only "
+        + measure + " between those two samples is computed."
+    );
+    second_comparand.option->group( group );
+    second_comparand.option->needs( comparand.option );
+
+    // Settings: Comparand list
+    comparand_list.option = sub->add_option(
+        "--comparand-list",
+        comparand_list.value,
+        "By default, " + measure + " between all pairs of samples is computed. If this option is "
+        "given a file containing tab-separated pairs of sample names (one pair per line) however, "
+        "only these pairwise " + measure + " values are computed."
+    );
+    comparand_list.option->group( group );
+    comparand_list.option->check( CLI::ExistingFile );
+    comparand_list.option->excludes( comparand.option );
+    comparand_list.option->excludes( second_comparand.option );
+}
+
+// =================================================================================================
+//      Run Functions
+// =================================================================================================
+
+std::vector<std::pair<size_t, size_t>> SamplePairsOptions::get_sample_pairs(
+    std::vector<std::string> const& sample_names
+) const {
+    // Get all pairs of samples for which we want to compute the measure.
+    std::vector<std::pair<size_t, size_t>> sample_pairs;
+    if( *comparand.option ) {
+        if( *second_comparand.option ) {
+            // Only exactly one pair of samples.
+            auto const index_a = get_sample_index( comparand.value, sample_names );
+            auto const index_b = get_sample_index( second_comparand.value, sample_names );
+            sample_pairs.emplace_back( index_a, index_b );
+        } else {
+            // One sample against all others.
+            auto const index_a = get_sample_index( comparand.value, sample_names );
+            for( auto const& sn : sample_names ) {
+                if( sn != comparand.value ) {
+                    auto const index_b = get_sample_index( sn, sample_names );
+                    sample_pairs.emplace_back( index_a, index_b );
+                }
+            }
+        }
+    } else if( *comparand_list.option ) {
+        // Read list of pairs from file.
+        sample_pairs = read_sample_pairs_file(
+            comparand_list.value, sample_names, comparand_list.option
+        );
+    } else {
+        // All pairs. Build upper triangle list of sample indices.
+        for( size_t i = 0; i < sample_names.size(); ++i ) {
+            for( size_t j = i + 1; j < sample_names.size(); ++j ) {
+                sample_pairs.emplace_back( i, j );
+            }
+        }
+    }
+    return sample_pairs;
+}
+
+std::vector<std::pair<size_t, size_t>> SamplePairsOptions::read_sample_pairs_file(
+    std::string const& file,
+    std::vector<std::string> const& sample_names,
+    CLI::Option const* option
+) {
+    using namespace genesis::utils;
+
+    std::vector<std::pair<size_t, size_t>> sample_pairs;
+    auto const lines = file_read_lines( file );
+    for( size_t i = 0; i < lines.size(); ++i ) {
+        auto const& line = lines[i];
+        auto const pair = split( line, "\t", false );
+        if( pair.size() != 2 ) {
+            throw CLI::ValidationError(
+                option->get_name() + "(" + file + ")",
+                "Invalid line that does not contain two sample names (line " +
+                std::to_string( i + 1 ) + ")."
+            );
+        }
+        auto const index_a = get_sample_index( pair[0], sample_names );
+        auto const index_b = get_sample_index( pair[1], sample_names );
+        sample_pairs.emplace_back( index_a, index_b );
+    }
+    return sample_pairs;
+}
+
+size_t SamplePairsOptions::get_sample_index(
+    std::string const& name,
+    std::vector<std::string> const& sample_names
+) {
+    auto it = std::find( sample_names.begin(), sample_names.end(), name );
+    if( it == sample_names.end() ) {
+        throw CLI::ValidationError(
+            "Invalid sample name: \"" + name  + "\" that was not found in the input, "
+            "or was filtered out."
+        );
+    }
+    return static_cast<size_t>( it - sample_names.begin() );
+}
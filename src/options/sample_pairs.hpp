@@ -0,0 +1,123 @@
+#ifndef GRENEDALF_OPTIONS_SAMPLE_PAIRS_H_
+#define GRENEDALF_OPTIONS_SAMPLE_PAIRS_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "CLI/CLI.hpp"
+
+#include "tools/cli_option.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Sample Pairs Options
+// =================================================================================================
+
+/**
+ * @brief Options to select pairs of samples for which a pairwise measure shall be computed.
+ *
+ * By default, all pairs of samples are used. The user can instead select one sample against
+ * all others, a single pair of samples, or provide a file with a list of pairs.
+ */
+class SamplePairsOptions
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    SamplePairsOptions()  = default;
+    virtual ~SamplePairsOptions() = default;
+
+    SamplePairsOptions( SamplePairsOptions const& other ) = default;
+    SamplePairsOptions( SamplePairsOptions&& )            = default;
+
+    SamplePairsOptions& operator= ( SamplePairsOptions const& other ) = default;
+    SamplePairsOptions& operator= ( SamplePairsOptions&& )            = default;
+
+    // -------------------------------------------------------------------------
+    //     Setup Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Add the comparand options to the app.
+     *
+     * The @p measure is the name of what is computed between the pairs of samples,
+     * such as "F_ST", and is used in the help messages of the options.
+     */
+    void add_sample_pairs_opts_to_app(
+        CLI::App* sub,
+        std::string const& measure,
+        std::string const& group = "Settings"
+    );
+
+    // -------------------------------------------------------------------------
+    //     Run Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Get the pairs of sample indices selected by the user, as indices into the
+     * @p sample_names, which are the names of the samples that are not filtered out.
+     */
+    std::vector<std::pair<size_t, size_t>> get_sample_pairs(
+        std::vector<std::string> const& sample_names
+    ) const;
+
+    /**
+     * @brief Read a file containing tab-separated pairs of sample names, one pair per line,
+     * and return them as indices into the @p sample_names.
+     *
+     * The @p option is used for user error messages.
+     */
+    static std::vector<std::pair<size_t, size_t>> read_sample_pairs_file(
+        std::string const& file,
+        std::vector<std::string> const& sample_names,
+        CLI::Option const* option
+    );
+
+    /**
+     * @brief Get the index of a sample name within the list of @p sample_names,
+     * or throw if the name is not found.
+     */
+    static size_t get_sample_index(
+        std::string const& name,
+        std::vector<std::string> const& sample_names
+    );
+
+    // -------------------------------------------------------------------------
+    //     Option Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    CliOption<std::string> comparand = "";
+    CliOption<std::string> second_comparand = "";
+    CliOption<std::string> comparand_list = "";
+
+};
+
+#endif // include guard
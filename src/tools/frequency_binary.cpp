@@ -0,0 +1,483 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/frequency_binary.hpp"
+
+#include "genesis/population/functions/base_counts.hpp"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Current version of the binary format.
+ */
+static const std::uint32_t frequency_binary_version_ = 1;
+
+/**
+ * @brief Byte order mark, to check that the file was written little-endian.
+ */
+static const std::uint32_t frequency_binary_bom_ = 0x01020304;
+
+/**
+ * @brief Append the bytes of an arithmetic @p value to a @p buffer.
+ *
+ * The format is little-endian, which is checked when starting the binary output.
+ */
+template<typename T>
+void append_binary_( std::string& buffer, T value )
+{
+    static_assert( std::is_arithmetic<T>::value, "append_binary_() only works for numbers" );
+    char bytes[ sizeof( T ) ];
+    std::memcpy( bytes, &value, sizeof( T ));
+    buffer.append( bytes, sizeof( T ));
+}
+
+/**
+ * @brief Append zero bytes to a @p buffer until its size is a multiple of 8.
+ */
+void append_binary_padding_( std::string& buffer )
+{
+    while( buffer.size() % 8 != 0 ) {
+        buffer.push_back( '\0' );
+    }
+}
+
+/**
+ * @brief Read an arithmetic value from the bytes at @p data.
+ */
+template<typename T>
+T read_binary_( char const* data )
+{
+    static_assert( std::is_arithmetic<T>::value, "read_binary_() only works for numbers" );
+    T value;
+    std::memcpy( &value, data, sizeof( T ));
+    return value;
+}
+
+/**
+ * @brief Check that the system is little-endian, as the format is written in host byte order.
+ */
+void check_binary_byte_order_()
+{
+    unsigned char bom_bytes[4];
+    std::memcpy( bom_bytes, &frequency_binary_bom_, 4 );
+    if( bom_bytes[0] != 0x04 ) {
+        throw std::runtime_error(
+            "The binary frequency format can only be used on little-endian systems."
+        );
+    }
+}
+
+// =================================================================================================
+//      Binary Frequency Writer
+// =================================================================================================
+
+FrequencyBinaryWriter::FrequencyBinaryWriter(
+    std::ostream& target,
+    std::vector<std::string> const& sample_names,
+    std::uint32_t field_flags,
+    size_t chunk_size
+)
+    : target_( target )
+    , sample_count_( sample_names.size() )
+    , field_flags_( field_flags )
+    , chunk_size_( chunk_size )
+{
+    check_binary_byte_order_();
+    if( chunk_size_ == 0 || chunk_size_ > std::numeric_limits<std::uint32_t>::max() ) {
+        throw std::invalid_argument( "Invalid chunk size for binary frequency output." );
+    }
+
+    // Prepare the sample columns.
+    size_t field_count = 0;
+    for( std::uint32_t flag = 1; flag <= kBinaryAltCount; flag <<= 1 ) {
+        field_count += static_cast<size_t>(( field_flags_ & flag ) != 0 );
+    }
+    sample_columns_.resize( sample_count_ * field_count );
+
+    // Write the file header.
+    buffer_.append( "GRNDFREQ" );
+    append_binary_<std::uint32_t>( buffer_, frequency_binary_version_ );
+    append_binary_<std::uint32_t>( buffer_, frequency_binary_bom_ );
+    append_binary_<std::uint32_t>( buffer_, field_flags_ );
+    append_binary_<std::uint32_t>( buffer_, sample_count_ );
+    append_binary_<std::uint32_t>( buffer_, chunk_size_ );
+    for( auto const& name : sample_names ) {
+        append_binary_<std::uint32_t>( buffer_, name.size() );
+        buffer_.append( name );
+    }
+    append_binary_padding_( buffer_ );
+    target_.write( buffer_.data(), buffer_.size() );
+    file_offset_ = buffer_.size();
+}
+
+void FrequencyBinaryWriter::add( genesis::population::Variant const& variant )
+{
+    using namespace genesis::population;
+
+    if( finished_ ) {
+        throw std::runtime_error( "Binary frequency output is already finished." );
+    }
+    if( variant.samples.size() != sample_count_ ) {
+        throw std::runtime_error(
+            "Input has inconsistent number of samples at " + variant.chromosome + ":" +
+            std::to_string( variant.position )
+        );
+    }
+
+    // Chromosome runs, and delta encoding of positions within each run.
+    size_t delta = variant.position;
+    if( chromosome_runs_.empty() || chromosome_runs_.back().first != variant.chromosome ) {
+        chromosome_runs_.emplace_back( variant.chromosome, 0 );
+    } else {
+        if( variant.position < last_position_ ) {
+            throw std::runtime_error(
+                "Input positions are not sorted within chromosome " + variant.chromosome
+            );
+        }
+        delta = variant.position - last_position_;
+    }
+    if( delta > std::numeric_limits<std::uint32_t>::max() ) {
+        throw std::runtime_error(
+            "Position " + std::to_string( variant.position ) + " on chromosome " +
+            variant.chromosome + " exceeds the range of positions that can be stored in "
+            "the binary format."
+        );
+    }
+    ++chromosome_runs_.back().second;
+    append_binary_<std::uint32_t>( positions_, delta );
+    last_position_ = variant.position;
+
+    ref_bases_.push_back( variant.reference_base );
+    alt_bases_.push_back( variant.alternative_base );
+
+    // Per sample columns, in the order of the format description.
+    size_t col = 0;
+    for( auto const& sample : variant.samples ) {
+        auto const ref_cnt = get_base_count( sample, variant.reference_base );
+        auto const alt_cnt = get_base_count( sample, variant.alternative_base );
+        auto const cnt_sum = ref_cnt + alt_cnt;
+
+        if( field_flags_ & kBinaryCoverage ) {
+            append_binary_<std::uint32_t>( sample_columns_[col++], cnt_sum );
+        }
+        if( field_flags_ & kBinaryFrequency ) {
+            float freq = std::numeric_limits<float>::quiet_NaN();
+            if( cnt_sum > 0 ) {
+                freq = static_cast<float>(
+                    static_cast<double>( ref_cnt ) / static_cast<double>( cnt_sum )
+                );
+            }
+            append_binary_<float>( sample_columns_[col++], freq );
+        }
+        if( field_flags_ & kBinaryRefCount ) {
+            append_binary_<std::uint32_t>( sample_columns_[col++], ref_cnt );
+        }
+        if( field_flags_ & kBinaryAltCount ) {
+            append_binary_<std::uint32_t>( sample_columns_[col++], alt_cnt );
+        }
+    }
+    if( col != sample_columns_.size() ) {
+        throw std::runtime_error( "Internal error: Invalid number of binary columns." );
+    }
+
+    ++chunk_used_;
+    if( chunk_used_ == chunk_size_ ) {
+        write_chunk_();
+    }
+}
+
+void FrequencyBinaryWriter::finish()
+{
+    if( finished_ ) {
+        return;
+    }
+    if( chunk_used_ > 0 ) {
+        write_chunk_();
+    }
+
+    // Write the footer with the chunk offsets.
+    buffer_.clear();
+    for( auto const offset : chunk_offsets_ ) {
+        append_binary_<std::uint64_t>( buffer_, offset );
+    }
+    append_binary_<std::uint64_t>( buffer_, chunk_offsets_.size() );
+    buffer_.append( "GRNDFEND" );
+    target_.write( buffer_.data(), buffer_.size() );
+    finished_ = true;
+}
+
+void FrequencyBinaryWriter::write_chunk_()
+{
+    // Build the chromosome run column first, as its size is not known in advance.
+    std::string chromosomes;
+    append_binary_<std::uint32_t>( chromosomes, chromosome_runs_.size() );
+    for( auto const& run : chromosome_runs_ ) {
+        append_binary_<std::uint32_t>( chromosomes, run.second );
+        append_binary_<std::uint32_t>( chromosomes, run.first.size() );
+        chromosomes.append( run.first );
+    }
+
+    // All columns, in order, so that we can compute their offsets.
+    std::vector<std::string const*> columns;
+    columns.push_back( &chromosomes );
+    columns.push_back( &positions_ );
+    columns.push_back( &ref_bases_ );
+    columns.push_back( &alt_bases_ );
+    for( auto const& column : sample_columns_ ) {
+        columns.push_back( &column );
+    }
+
+    // Chunk header with the column offsets. The header size is a multiple of 8 already.
+    buffer_.clear();
+    append_binary_<std::uint32_t>( buffer_, chunk_used_ );
+    append_binary_<std::uint32_t>( buffer_, columns.size() );
+    std::uint64_t offset = 8 + 8 * columns.size();
+    for( auto const* column : columns ) {
+        append_binary_<std::uint64_t>( buffer_, offset );
+        offset += ( column->size() + 7 ) / 8 * 8;
+    }
+
+    // Columns, with padding.
+    for( auto const* column : columns ) {
+        buffer_.append( *column );
+        append_binary_padding_( buffer_ );
+    }
+    if( buffer_.size() != offset ) {
+        throw std::runtime_error( "Internal error: Invalid binary chunk size." );
+    }
+    target_.write( buffer_.data(), buffer_.size() );
+    chunk_offsets_.push_back( file_offset_ );
+    file_offset_ += buffer_.size();
+
+    // Reset the chunk, keeping the memory of its columns.
+    chunk_used_ = 0;
+    chromosome_runs_.clear();
+    positions_.clear();
+    last_position_ = 0;
+    ref_bases_.clear();
+    alt_bases_.clear();
+    for( auto& column : sample_columns_ ) {
+        column.clear();
+    }
+}
+
+// =================================================================================================
+//      Binary Frequency Reader
+// =================================================================================================
+
+FrequencyBinaryReader::FrequencyBinaryReader( std::string const& file )
+    : file_( file )
+{
+    check_binary_byte_order_();
+    auto const data = file_.data();
+    auto const size = file_.size();
+    auto invalid_ = [&]( std::string const& reason ){
+        return std::runtime_error( "Invalid binary frequency file " + file + ": " + reason );
+    };
+
+    // Header.
+    if( size < 32 || std::memcmp( data, "GRNDFREQ", 8 ) != 0 ) {
+        throw invalid_( "Not a binary frequency file." );
+    }
+    if( read_binary_<std::uint32_t>( data + 8 ) != frequency_binary_version_ ) {
+        throw invalid_( "Unsupported format version." );
+    }
+    if( read_binary_<std::uint32_t>( data + 12 ) != frequency_binary_bom_ ) {
+        throw invalid_( "Invalid byte order." );
+    }
+    field_flags_ = read_binary_<std::uint32_t>( data + 16 );
+    if( field_flags_ > ( kBinaryCoverage | kBinaryFrequency | kBinaryRefCount | kBinaryAltCount )) {
+        throw invalid_( "Unknown fields." );
+    }
+    for( std::uint32_t flag = 1; flag <= kBinaryAltCount; flag <<= 1 ) {
+        field_count_ += static_cast<size_t>(( field_flags_ & flag ) != 0 );
+    }
+    auto const sample_count = read_binary_<std::uint32_t>( data + 20 );
+    size_t pos = 28;
+    for( size_t s = 0; s < sample_count; ++s ) {
+        if( pos + 4 > size ) {
+            throw invalid_( "Truncated header." );
+        }
+        auto const length = read_binary_<std::uint32_t>( data + pos );
+        pos += 4;
+        if( pos + length > size ) {
+            throw invalid_( "Truncated header." );
+        }
+        sample_names_.emplace_back( data + pos, length );
+        pos += length;
+    }
+    auto const header_end = ( pos + 7 ) / 8 * 8;
+
+    // Footer.
+    if( size < header_end + 16 || std::memcmp( data + size - 8, "GRNDFEND", 8 ) != 0 ) {
+        throw invalid_( "Missing footer, the file might be truncated." );
+    }
+    auto const chunk_count = read_binary_<std::uint64_t>( data + size - 16 );
+    if( chunk_count > ( size - header_end - 16 ) / 8 ) {
+        throw invalid_( "Invalid chunk count." );
+    }
+    auto const footer_begin = size - 16 - 8 * chunk_count;
+    for( size_t c = 0; c < chunk_count; ++c ) {
+        chunk_offsets_.push_back( read_binary_<std::uint64_t>( data + footer_begin + 8 * c ));
+    }
+
+    // Check the chunks and their columns, so that column accesses do not need to.
+    auto const column_count = 4 + sample_names_.size() * field_count_;
+    for( size_t c = 0; c < chunk_count; ++c ) {
+        auto const begin = chunk_offsets_[c];
+        auto const end = ( c + 1 < chunk_count ) ? chunk_offsets_[ c + 1 ] : footer_begin;
+        if( begin < header_end || begin > end || end - begin < 8 + 8 * column_count ) {
+            throw invalid_( "Invalid chunk offset." );
+        }
+        auto const n = read_binary_<std::uint32_t>( data + begin );
+        if( read_binary_<std::uint32_t>( data + begin + 4 ) != column_count ) {
+            throw invalid_( "Invalid number of columns." );
+        }
+        for( size_t col = 0; col < column_count; ++col ) {
+            auto const offset = read_binary_<std::uint64_t>( data + begin + 8 + 8 * col );
+            // The chromosome column has at least its run count, bases are one byte each,
+            // and all other columns are four bytes per position.
+            size_t const length = ( col == 0 ? 4 : ( col == 2 || col == 3 ) ? n : 4 * n );
+            if( offset % 8 != 0 || offset > end - begin || length > end - begin - offset ) {
+                throw invalid_( "Invalid column offset." );
+            }
+        }
+    }
+}
+
+size_t FrequencyBinaryReader::chunk_size( size_t chunk ) const
+{
+    if( chunk >= chunk_offsets_.size() ) {
+        throw std::out_of_range( "Invalid chunk index in binary frequency file." );
+    }
+    return read_binary_<std::uint32_t>( file_.data() + chunk_offsets_[ chunk ] );
+}
+
+std::vector<std::pair<std::string, size_t>> FrequencyBinaryReader::chromosome_runs(
+    size_t chunk
+) const {
+    // The column offsets are checked, but the run entries are variable in size,
+    // so we check them while reading, against the start of the next column.
+    auto const column = column_( chunk, 0 );
+    auto const limit = column_( chunk, 1 );
+    auto const run_count = read_binary_<std::uint32_t>( column );
+    std::vector<std::pair<std::string, size_t>> result;
+    auto pos = column + 4;
+    for( size_t r = 0; r < run_count; ++r ) {
+        if( limit - pos < 8 ) {
+            throw std::runtime_error( "Invalid chromosome column in binary frequency file." );
+        }
+        auto const count = read_binary_<std::uint32_t>( pos );
+        auto const length = read_binary_<std::uint32_t>( pos + 4 );
+        pos += 8;
+        if( static_cast<size_t>( limit - pos ) < length ) {
+            throw std::runtime_error( "Invalid chromosome column in binary frequency file." );
+        }
+        result.emplace_back( std::string( pos, length ), count );
+        pos += length;
+    }
+    return result;
+}
+
+std::vector<size_t> FrequencyBinaryReader::positions( size_t chunk ) const
+{
+    auto const runs = chromosome_runs( chunk );
+    auto const n = chunk_size( chunk );
+    auto const column = column_( chunk, 1 );
+    std::vector<size_t> result;
+    result.reserve( n );
+    for( auto const& run : runs ) {
+        size_t position = 0;
+        for( size_t i = 0; i < run.second; ++i ) {
+            if( result.size() == n ) {
+                throw std::runtime_error( "Invalid chromosome column in binary frequency file." );
+            }
+            position += read_binary_<std::uint32_t>( column + 4 * result.size() );
+            result.push_back( position );
+        }
+    }
+    if( result.size() != n ) {
+        throw std::runtime_error( "Invalid chromosome column in binary frequency file." );
+    }
+    return result;
+}
+
+char const* FrequencyBinaryReader::reference_bases( size_t chunk ) const
+{
+    return column_( chunk, 2 );
+}
+
+char const* FrequencyBinaryReader::alternative_bases( size_t chunk ) const
+{
+    return column_( chunk, 3 );
+}
+
+std::uint32_t const* FrequencyBinaryReader::counts(
+    size_t chunk, size_t sample, FrequencyBinaryField field
+) const {
+    if( field == kBinaryFrequency ) {
+        throw std::invalid_argument( "Frequencies are stored as float values, use frequencies()." );
+    }
+    return reinterpret_cast<std::uint32_t const*>( column_( chunk, sample_column_( sample, field )));
+}
+
+float const* FrequencyBinaryReader::frequencies( size_t chunk, size_t sample ) const
+{
+    return reinterpret_cast<float const*>(
+        column_( chunk, sample_column_( sample, kBinaryFrequency ))
+    );
+}
+
+char const* FrequencyBinaryReader::column_( size_t chunk, size_t column ) const
+{
+    if( chunk >= chunk_offsets_.size() ) {
+        throw std::out_of_range( "Invalid chunk index in binary frequency file." );
+    }
+    auto const begin = file_.data() + chunk_offsets_[ chunk ];
+    return begin + read_binary_<std::uint64_t>( begin + 8 + 8 * column );
+}
+
+size_t FrequencyBinaryReader::sample_column_( size_t sample, FrequencyBinaryField field ) const
+{
+    if( sample >= sample_names_.size() ) {
+        throw std::out_of_range( "Invalid sample index in binary frequency file." );
+    }
+    if(( field_flags_ & field ) == 0 ) {
+        throw std::invalid_argument( "Field was not written to the binary frequency file." );
+    }
+
+    // The fields of a sample are in the order of their flags, so the rank of the field
+    // is the number of fields with a smaller flag.
+    size_t rank = 0;
+    for( std::uint32_t flag = 1; flag < static_cast<std::uint32_t>( field ); flag <<= 1 ) {
+        rank += static_cast<size_t>(( field_flags_ & flag ) != 0 );
+    }
+    return 4 + sample * field_count_ + rank;
+}
@@ -0,0 +1,265 @@
+#ifndef GRENEDALF_TOOLS_FREQUENCY_BINARY_H_
+#define GRENEDALF_TOOLS_FREQUENCY_BINARY_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/population/variant.hpp"
+
+#include "tools/mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Binary Frequency Format
+// =================================================================================================
+
+/*
+ * Layout of the binary columnar format written by `grenedalf frequency --format binary`.
+ * See also doc/md/frequency_binary_format.md for the description for users. All numbers are
+ * stored little-endian, and all sections and columns start at an offset that is a multiple of
+ * 8 bytes (padded with zeros), so that the file can be memory-mapped and the columns accessed
+ * as typed arrays directly.
+ *
+ * Header:
+ *
+ *   - magic `GRNDFREQ` (8 bytes), uint32 format version, uint32 byte order mark `0x01020304`
+ *   - uint32 field flags: 1 = COV, 2 = FREQ, 4 = REF_CNT, 8 = ALT_CNT
+ *   - uint32 sample count, uint32 maximum number of positions per chunk
+ *   - per sample: uint32 name length, followed by the name
+ *
+ * Chunks, one after another:
+ *
+ *   - uint32 number of positions n in the chunk, uint32 number of columns c
+ *   - c times uint64 offset of the column, relative to the start of the chunk, in the order
+ *     CHROM, POS, REF, ALT, and then for each sample the selected fields in the order above
+ *   - CHROM: run-length encoded, uint32 run count, and per run uint32 number of positions,
+ *     uint32 name length, and the name
+ *   - POS: n times uint32, delta encoded: the first position of each chromosome run is stored
+ *     as is, all others as the difference to the previous position
+ *   - REF, ALT: n times uint8 ASCII base
+ *   - COV, REF_CNT, ALT_CNT: n times uint32; FREQ: n times float32, with NaN for zero coverage
+ *
+ * Footer:
+ *
+ *   - per chunk uint64 offset of the chunk from the start of the file
+ *   - uint64 chunk count, and magic `GRNDFEND` (8 bytes)
+ *
+ * Readers hence can start at the end of the file to find the chunks, and use the column offsets
+ * of each chunk to only access the columns that they need.
+ */
+
+/**
+ * @brief Bit flags for the per-sample fields stored in the binary format.
+ */
+enum FrequencyBinaryField : std::uint32_t
+{
+    kBinaryCoverage  = 1,
+    kBinaryFrequency = 2,
+    kBinaryRefCount  = 4,
+    kBinaryAltCount  = 8
+};
+
+// =================================================================================================
+//      Binary Frequency Writer
+// =================================================================================================
+
+/**
+ * @brief Write Variant%s to a @p target stream in the binary columnar frequency format.
+ *
+ * The positions are collected in chunks, which are written once they are full. The last chunk
+ * and the footer are written by finish(), which needs to be called after the last Variant.
+ */
+class FrequencyBinaryWriter
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Start the binary output by writing the header to the @p target.
+     *
+     * The @p field_flags are a combination of FrequencyBinaryField values.
+     */
+    FrequencyBinaryWriter(
+        std::ostream& target,
+        std::vector<std::string> const& sample_names,
+        std::uint32_t field_flags,
+        size_t chunk_size = 65536
+    );
+    ~FrequencyBinaryWriter() = default;
+
+    FrequencyBinaryWriter( FrequencyBinaryWriter const& other ) = delete;
+    FrequencyBinaryWriter( FrequencyBinaryWriter&& )            = delete;
+
+    FrequencyBinaryWriter& operator= ( FrequencyBinaryWriter const& other ) = delete;
+    FrequencyBinaryWriter& operator= ( FrequencyBinaryWriter&& )            = delete;
+
+    // -------------------------------------------------------------------------
+    //     Writing
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Add a @p variant, which needs to have the number of samples given in the header.
+     */
+    void add( genesis::population::Variant const& variant );
+
+    /**
+     * @brief Write the last chunk and the footer.
+     */
+    void finish();
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    void write_chunk_();
+
+    std::ostream& target_;
+    size_t sample_count_;
+    std::uint32_t field_flags_;
+    size_t chunk_size_;
+    bool finished_ = false;
+
+    // Columns of the current chunk, filled position by position. Chromosome runs are pairs of
+    // name and position count. Sample columns are in the order of the format description.
+    size_t chunk_used_ = 0;
+    std::vector<std::pair<std::string, std::uint32_t>> chromosome_runs_;
+    std::string positions_;
+    size_t last_position_ = 0;
+    std::string ref_bases_;
+    std::string alt_bases_;
+    std::vector<std::string> sample_columns_;
+
+    // Output state.
+    std::string buffer_;
+    std::uint64_t file_offset_ = 0;
+    std::vector<std::uint64_t> chunk_offsets_;
+
+};
+
+// =================================================================================================
+//      Binary Frequency Reader
+// =================================================================================================
+
+/**
+ * @brief Read a file in the binary columnar frequency format.
+ *
+ * The file is memory-mapped, and the columns of each chunk are accessed in place, so that only
+ * the columns that are actually used are ever loaded from disk. The header and footer are checked
+ * when opening the file; column accesses then only need to check their indices.
+ */
+class FrequencyBinaryReader
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    explicit FrequencyBinaryReader( std::string const& file );
+    ~FrequencyBinaryReader() = default;
+
+    FrequencyBinaryReader( FrequencyBinaryReader const& other ) = delete;
+    FrequencyBinaryReader( FrequencyBinaryReader&& )            = delete;
+
+    FrequencyBinaryReader& operator= ( FrequencyBinaryReader const& other ) = delete;
+    FrequencyBinaryReader& operator= ( FrequencyBinaryReader&& )            = delete;
+
+    // -------------------------------------------------------------------------
+    //     Header
+    // -------------------------------------------------------------------------
+
+    std::vector<std::string> const& sample_names() const
+    {
+        return sample_names_;
+    }
+
+    std::uint32_t field_flags() const
+    {
+        return field_flags_;
+    }
+
+    size_t chunk_count() const
+    {
+        return chunk_offsets_.size();
+    }
+
+    // -------------------------------------------------------------------------
+    //     Chunk Columns
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Get the number of positions in a @p chunk.
+     */
+    size_t chunk_size( size_t chunk ) const;
+
+    /**
+     * @brief Get the chromosome runs of a @p chunk, as pairs of name and number of positions.
+     */
+    std::vector<std::pair<std::string, size_t>> chromosome_runs( size_t chunk ) const;
+
+    /**
+     * @brief Get the positions of a @p chunk, with the delta encoding resolved.
+     */
+    std::vector<size_t> positions( size_t chunk ) const;
+
+    char const* reference_bases( size_t chunk ) const;
+    char const* alternative_bases( size_t chunk ) const;
+
+    /**
+     * @brief Get the column of a per-sample @p field of a @p chunk, as an array of
+     * chunk_size() values, or throw if the field was not written to the file.
+     *
+     * The FREQ field uses float values, all other fields use uint32 values.
+     */
+    std::uint32_t const* counts( size_t chunk, size_t sample, FrequencyBinaryField field ) const;
+    float const* frequencies( size_t chunk, size_t sample ) const;
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    char const* column_( size_t chunk, size_t column ) const;
+    size_t sample_column_( size_t sample, FrequencyBinaryField field ) const;
+
+    MappedFile file_;
+    std::vector<std::string> sample_names_;
+    std::uint32_t field_flags_ = 0;
+    size_t field_count_ = 0;
+    std::vector<std::uint64_t> chunk_offsets_;
+
+};
+
+#endif // include guard
@@ -0,0 +1,229 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/genome_mask.hpp"
+
+#include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/io/input_stream.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+// =================================================================================================
+//      Helpers
+// =================================================================================================
+
+/**
+ * @brief Count the set bits in a word.
+ */
+inline size_t popcount_( std::uint64_t word )
+{
+    return static_cast<size_t>( __builtin_popcountll( word ));
+}
+
+/**
+ * @brief Parse an unsigned number for the BED reader, with a useful error message.
+ */
+size_t parse_bed_number_( std::string const& text, std::string const& file, size_t line_num )
+{
+    if( text.empty() || text.find_first_not_of( "0123456789" ) != std::string::npos ) {
+        throw std::runtime_error(
+            "Invalid BED file " + file + " with invalid position in line " +
+            std::to_string( line_num )
+        );
+    }
+    return static_cast<size_t>( std::strtoull( text.c_str(), nullptr, 10 ));
+}
+
+// =================================================================================================
+//      Reading
+// =================================================================================================
+
+void GenomeMask::add_bed_file( std::string const& file )
+{
+    using namespace genesis::utils;
+
+    std::string line;
+    size_t line_num = 0;
+    InputStream input( from_file( file ));
+    while( input ) {
+        line.clear();
+        input.get_line( line );
+        ++line_num;
+
+        // Skip empty and header lines.
+        if(
+            line.empty() || line[0] == '#' ||
+            line.compare( 0, 5, "track" ) == 0 || line.compare( 0, 7, "browser" ) == 0
+        ) {
+            continue;
+        }
+
+        // Get the first three columns. Further columns are ignored.
+        auto const tab1 = line.find( '\t' );
+        auto const tab2 = ( tab1 == std::string::npos ) ? tab1 : line.find( '\t', tab1 + 1 );
+        if( tab2 == std::string::npos ) {
+            throw std::runtime_error(
+                "Invalid BED file " + file + " with less than three columns in line " +
+                std::to_string( line_num )
+            );
+        }
+        auto tab3 = line.find( '\t', tab2 + 1 );
+        if( tab3 == std::string::npos ) {
+            tab3 = line.size();
+        }
+        auto const start = parse_bed_number_( line.substr( tab1 + 1, tab2 - tab1 - 1 ), file, line_num );
+        auto const end   = parse_bed_number_( line.substr( tab2 + 1, tab3 - tab2 - 1 ), file, line_num );
+        if( start > end ) {
+            throw std::runtime_error(
+                "Invalid BED file " + file + " with start > end in line " +
+                std::to_string( line_num )
+            );
+        }
+
+        // BED is 0-based with exclusive end, so that the 1-based inclusive interval is this.
+        // Empty intervals are simply skipped.
+        if( start < end ) {
+            add_interval( line.substr( 0, tab1 ), start + 1, end );
+        }
+    }
+}
+
+void GenomeMask::add_fasta_file( std::string const& file )
+{
+    using namespace genesis::utils;
+
+    std::string line;
+    Bits* bits = nullptr;
+    size_t position = 0;
+    InputStream input( from_file( file ));
+    while( input ) {
+        line.clear();
+        input.get_line( line );
+        if( line.empty() ) {
+            continue;
+        }
+
+        // New sequence. Its name is the chromosome, up to the first white space.
+        if( line[0] == '>' ) {
+            auto const name = line.substr( 1, line.find_first_of( " \t" ) - 1 );
+            bits = &chromosomes_[ name ];
+            position = 0;
+            continue;
+        }
+        if( ! bits ) {
+            throw std::runtime_error( "Invalid FASTA mask file " + file + " without sequence name" );
+        }
+
+        // Set the bits for the positions of the line, growing the bit vector once per line.
+        auto const words = ( position + line.size() + 63 ) / 64;
+        if( bits->size() < words ) {
+            bits->resize( words, 0 );
+        }
+        for( auto const c : line ) {
+            if( c != '0' ) {
+                (*bits)[ position / 64 ] |= std::uint64_t( 1 ) << ( position % 64 );
+            }
+            ++position;
+        }
+    }
+}
+
+void GenomeMask::add_interval( std::string const& chromosome, size_t first, size_t last )
+{
+    if( first == 0 || first > last ) {
+        throw std::runtime_error(
+            "Invalid mask interval " + chromosome + ":" + std::to_string( first ) + "-" +
+            std::to_string( last )
+        );
+    }
+
+    // Grow the bit vector as needed. We use 0-based indices here.
+    auto& bits = chromosomes_[ chromosome ];
+    auto const begin = first - 1;
+    auto const end   = last;
+    if( bits.size() < ( end + 63 ) / 64 ) {
+        bits.resize(( end + 63 ) / 64, 0 );
+    }
+
+    // Set whole words where possible, and the bits at the boundaries individually.
+    size_t index = begin;
+    while( index < end && index % 64 != 0 ) {
+        bits[ index / 64 ] |= std::uint64_t( 1 ) << ( index % 64 );
+        ++index;
+    }
+    while( index + 64 <= end ) {
+        bits[ index / 64 ] = ~std::uint64_t( 0 );
+        index += 64;
+    }
+    while( index < end ) {
+        bits[ index / 64 ] |= std::uint64_t( 1 ) << ( index % 64 );
+        ++index;
+    }
+}
+
+// =================================================================================================
+//      Accessors
+// =================================================================================================
+
+size_t GenomeMask::masked_count( std::string const& chromosome, size_t first, size_t last ) const
+{
+    auto const bits = chromosome_bits( chromosome );
+    if( ! bits || first > last || first == 0 ) {
+        return 0;
+    }
+
+    // Limit to the bits that we have, and use 0-based indices with exclusive end.
+    auto const begin = first - 1;
+    auto const end = std::min<size_t>( last, bits->size() * 64 );
+    if( begin >= end ) {
+        return 0;
+    }
+
+    // Count the bits in the boundary words with masks, and the full words in between.
+    auto const first_word = begin / 64;
+    auto const last_word  = ( end - 1 ) / 64;
+    auto const first_mask = ~std::uint64_t( 0 ) << ( begin % 64 );
+    auto const last_mask  = ~std::uint64_t( 0 ) >> ( 63 - (( end - 1 ) % 64 ));
+    if( first_word == last_word ) {
+        return popcount_( (*bits)[ first_word ] & first_mask & last_mask );
+    }
+    size_t result = popcount_( (*bits)[ first_word ] & first_mask );
+    for( size_t i = first_word + 1; i < last_word; ++i ) {
+        result += popcount_( (*bits)[i] );
+    }
+    result += popcount_( (*bits)[ last_word ] & last_mask );
+    return result;
+}
+
+size_t GenomeMask::masked_count() const
+{
+    size_t result = 0;
+    for( auto const& chromosome : chromosomes_ ) {
+        for( auto const word : chromosome.second ) {
+            result += popcount_( word );
+        }
+    }
+    return result;
+}
@@ -0,0 +1,149 @@
+#ifndef GRENEDALF_TOOLS_GENOME_MASK_H_
+#define GRENEDALF_TOOLS_GENOME_MASK_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// =================================================================================================
+//      Genome Mask
+// =================================================================================================
+
+/**
+ * @brief Mask of positions along the chromosomes of a genome, stored as one bit per position.
+ *
+ * Positions are 1-based, as in the rest of grenedalf. Each chromosome gets a packed bit vector
+ * that grows as needed, so that a 3 Gbp genome needs about 375 MB. Positions beyond the end of
+ * the bit vector of a chromosome, or on chromosomes without any mask, are not masked.
+ */
+class GenomeMask
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Typedefs and Constructors
+    // -------------------------------------------------------------------------
+
+    using Bits = std::vector<std::uint64_t>;
+
+    GenomeMask()  = default;
+    ~GenomeMask() = default;
+
+    GenomeMask( GenomeMask const& other ) = default;
+    GenomeMask( GenomeMask&& )            = default;
+
+    GenomeMask& operator= ( GenomeMask const& other ) = default;
+    GenomeMask& operator= ( GenomeMask&& )            = default;
+
+    // -------------------------------------------------------------------------
+    //     Reading
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Mask all intervals in a BED file.
+     *
+     * Only the first three columns (chromosome, start, end) are used. As usual for BED, the start
+     * is 0-based and the end is exclusive. Header lines starting with `#`, `track`, or `browser`
+     * are skipped.
+     */
+    void add_bed_file( std::string const& file );
+
+    /**
+     * @brief Mask the positions given by a FASTA file.
+     *
+     * The file contains one sequence per chromosome, named as the chromosome, where each character
+     * stands for one position. The character `0` means that the position is not masked, while
+     * any other character masks the position, as in the mask files used by vcftools.
+     */
+    void add_fasta_file( std::string const& file );
+
+    /**
+     * @brief Mask an interval of positions, with 1-based inclusive @p first and @p last.
+     */
+    void add_interval( std::string const& chromosome, size_t first, size_t last );
+
+    // -------------------------------------------------------------------------
+    //     Accessors
+    // -------------------------------------------------------------------------
+
+    bool empty() const
+    {
+        return chromosomes_.empty();
+    }
+
+    /**
+     * @brief Get the bits of a @p chromosome, or `nullptr` if it does not have any mask.
+     *
+     * This allows to test many positions on the same chromosome without looking up its name.
+     */
+    Bits const* chromosome_bits( std::string const& chromosome ) const
+    {
+        auto const it = chromosomes_.find( chromosome );
+        return it == chromosomes_.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief Test whether a 1-based @p position is set in the @p bits of a chromosome.
+     */
+    static bool is_masked( Bits const& bits, size_t position )
+    {
+        auto const index = position - 1;
+        auto const word = index / 64;
+        return word < bits.size() && (( bits[word] >> ( index % 64 )) & 1 );
+    }
+
+    /**
+     * @brief Test whether a 1-based @p position on a @p chromosome is masked.
+     */
+    bool is_masked( std::string const& chromosome, size_t position ) const
+    {
+        auto const bits = chromosome_bits( chromosome );
+        return bits && is_masked( *bits, position );
+    }
+
+    /**
+     * @brief Get the number of masked positions in the 1-based inclusive interval between
+     * @p first and @p last on a @p chromosome.
+     */
+    size_t masked_count( std::string const& chromosome, size_t first, size_t last ) const;
+
+    /**
+     * @brief Get the total number of masked positions.
+     */
+    size_t masked_count() const;
+
+    // -------------------------------------------------------------------------
+    //     Data Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    std::unordered_map<std::string, Bits> chromosomes_;
+
+};
+
+#endif // include guard
@@ -0,0 +1,68 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/mapped_file.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// =================================================================================================
+//      Constructor and Rule of Five
+// =================================================================================================
+
+MappedFile::MappedFile( std::string const& file )
+{
+    // Map the file. This does not read anything yet, the operating system loads the pages
+    // as they are accessed.
+    auto const fd = ::open( file.c_str(), O_RDONLY );
+    if( fd < 0 ) {
+        throw std::runtime_error( "Cannot open file " + file );
+    }
+    struct stat st;
+    if( ::fstat( fd, &st ) != 0 ) {
+        ::close( fd );
+        throw std::runtime_error( "Cannot open file " + file );
+    }
+    auto const size = static_cast<size_t>( st.st_size );
+    if( size > 0 ) {
+        auto const data = ::mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( data == MAP_FAILED ) {
+            ::close( fd );
+            throw std::runtime_error( "Cannot memory-map file " + file );
+        }
+        data_ = static_cast<char const*>( data );
+        size_ = size;
+    }
+    ::close( fd );
+}
+
+MappedFile::~MappedFile()
+{
+    if( data_ ) {
+        ::munmap( const_cast<char*>( data_ ), size_ );
+    }
+}
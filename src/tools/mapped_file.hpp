@@ -0,0 +1,83 @@
+#ifndef GRENEDALF_TOOLS_MAPPED_FILE_H_
+#define GRENEDALF_TOOLS_MAPPED_FILE_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstddef>
+#include <string>
+
+// =================================================================================================
+//      Mapped File
+// =================================================================================================
+
+/**
+ * @brief Read-only memory mapping of a whole file.
+ *
+ * The mapping is owned by the object, and released when it is destroyed, so that classes that
+ * use it as a member do not leak the mapping if their constructor throws afterwards.
+ * Empty files yield a `nullptr` data pointer. The class is not copyable.
+ */
+class MappedFile
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    explicit MappedFile( std::string const& file );
+    ~MappedFile();
+
+    MappedFile( MappedFile const& other ) = delete;
+    MappedFile( MappedFile&& )            = delete;
+
+    MappedFile& operator= ( MappedFile const& other ) = delete;
+    MappedFile& operator= ( MappedFile&& )            = delete;
+
+    // -------------------------------------------------------------------------
+    //     Accessors
+    // -------------------------------------------------------------------------
+
+    char const* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Data Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    char const* data_ = nullptr;
+    size_t size_ = 0;
+
+};
+
+#endif // include guard
@@ -0,0 +1,149 @@
+#ifndef GRENEDALF_TOOLS_ORDERED_BATCHES_H_
+#define GRENEDALF_TOOLS_ORDERED_BATCHES_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/utils/core/options.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+//      Ordered Parallel Batch Formatting
+// =================================================================================================
+
+/**
+ * @brief Format the elements of an input range in parallel, and write the results in order.
+ *
+ * Reading the input is inherently sequential, but formatting the output lines is often just as
+ * expensive. Hence, we collect the elements of the @p input in batches of @p batch_size, split
+ * each batch into one chunk per thread, and call the @p format function on each element of a chunk
+ * in parallel, which appends the text for the element to the buffer of its chunk. The buffers are
+ * then written to the @p target in order, so that the output is identical to sequential formatting.
+ *
+ * Writing a batch runs asynchronously, while the next batch is read and formatted. For that, we
+ * keep two sets of buffers, and alternate between them.
+ *
+ * The @p format function needs to have the signature `void( T const&, std::string& )`,
+ * where T is the value type of the @p input range, and needs to be thread safe. Exceptions thrown
+ * by the @p format function cannot leave the parallel region, so they are caught per chunk,
+ * and the first one (in input order) is re-thrown once the chunks of the batch are done.
+ */
+template<class T, class Range, class Formatter>
+void write_ordered_batches(
+    Range&& input,
+    std::ostream& target,
+    Formatter format,
+    size_t batch_size = 4096
+) {
+    auto const chunk_count = std::max<size_t>(
+        1, genesis::utils::Options::get().number_of_threads()
+    );
+
+    // Storage for the elements of the current batch, and the two sets of output buffers.
+    // The elements of the batch are kept between batches and assigned to, instead of cleared,
+    // so that their memory (such as the strings and vectors of a Variant) gets re-used.
+    std::vector<T> batch;
+    batch.reserve( batch_size );
+    size_t batch_used = 0;
+    std::array<std::vector<std::string>, 2> buffers;
+    buffers[0].resize( chunk_count );
+    buffers[1].resize( chunk_count );
+    size_t current = 0;
+    std::future<void> writer;
+
+    // Format the current batch into the current set of buffers, and start writing them.
+    auto process_batch_ = [&](){
+        auto& chunk_buffers = buffers[ current ];
+        auto const chunk_size = ( batch_used + chunk_count - 1 ) / chunk_count;
+        std::vector<std::exception_ptr> errors( chunk_count );
+
+        #pragma omp parallel for
+        for( size_t c = 0; c < chunk_count; ++c ) {
+            auto& buffer = chunk_buffers[c];
+            buffer.clear();
+            auto const begin = std::min( c * chunk_size, batch_used );
+            auto const end = std::min( begin + chunk_size, batch_used );
+            try {
+                for( size_t i = begin; i < end; ++i ) {
+                    format( batch[i], buffer );
+                }
+            } catch( ... ) {
+                errors[c] = std::current_exception();
+            }
+        }
+        batch_used = 0;
+
+        // Report errors only after the previous write is done, so that the output
+        // contains everything up to the batch that failed.
+        for( auto const& error : errors ) {
+            if( error ) {
+                if( writer.valid() ) {
+                    writer.get();
+                }
+                std::rethrow_exception( error );
+            }
+        }
+
+        // The previous write uses the other set of buffers. We wait for it to finish before
+        // starting the next one, so that the output stays in order, and so that the buffers
+        // of the previous write are free to be used for the next batch.
+        if( writer.valid() ) {
+            writer.get();
+        }
+        writer = std::async( std::launch::async, [&target, &chunk_buffers](){
+            for( auto const& buffer : chunk_buffers ) {
+                target.write( buffer.data(), buffer.size() );
+            }
+        });
+        current = 1 - current;
+    };
+
+    // Read the input, and process it batch by batch.
+    for( auto const& element : input ) {
+        if( batch_used < batch.size() ) {
+            batch[ batch_used ] = element;
+        } else {
+            batch.push_back( element );
+        }
+        ++batch_used;
+        if( batch_used == batch_size ) {
+            process_batch_();
+        }
+    }
+    if( batch_used > 0 ) {
+        process_batch_();
+    }
+    if( writer.valid() ) {
+        writer.get();
+    }
+}
+
+#endif // include guard
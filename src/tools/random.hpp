@@ -0,0 +1,337 @@
+#ifndef GRENEDALF_TOOLS_RANDOM_H_
+#define GRENEDALF_TOOLS_RANDOM_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// =================================================================================================
+//      Philox Engine
+// =================================================================================================
+
+/**
+ * @brief Counter-based random number engine, implementing Philox4x32-10.
+ *
+ * See John K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC'11. Each output is
+ * a pure function of the key (our seed), the stream number, and the position in the stream.
+ * Hence, independent streams can be used in parallel, for instance one per block of work, and the
+ * results do not depend on the number of threads or the order in which the streams are processed.
+ *
+ * The class models the standard UniformRandomBitGenerator requirements, so that it can be used
+ * with the distributions of the standard library.
+ */
+class PhiloxEngine
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Typedefs and Constants
+    // -------------------------------------------------------------------------
+
+    using result_type = std::uint32_t;
+
+    static constexpr result_type min()
+    {
+        return std::numeric_limits<result_type>::min();
+    }
+
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Create an engine for a given @p seed and @p stream.
+     *
+     * Engines with the same seed and different streams produce independent sequences.
+     */
+    PhiloxEngine( std::uint64_t seed = 0, std::uint64_t stream = 0 )
+    {
+        key_[0] = static_cast<std::uint32_t>( seed );
+        key_[1] = static_cast<std::uint32_t>( seed >> 32 );
+        counter_[0] = 0;
+        counter_[1] = 0;
+        counter_[2] = static_cast<std::uint32_t>( stream );
+        counter_[3] = static_cast<std::uint32_t>( stream >> 32 );
+    }
+
+    ~PhiloxEngine() = default;
+
+    PhiloxEngine( PhiloxEngine const& ) = default;
+    PhiloxEngine( PhiloxEngine&& )      = default;
+
+    PhiloxEngine& operator= ( PhiloxEngine const& ) = default;
+    PhiloxEngine& operator= ( PhiloxEngine&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Random Generation
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Get the next random value of the stream.
+     */
+    result_type operator()()
+    {
+        // Each counter value yields four outputs. Once they are used up, compute the next four.
+        if( buffer_pos_ == buffer_.size() ) {
+            buffer_ = generate_block_( counter_, key_ );
+            buffer_pos_ = 0;
+
+            // Increment the 64 bit position in the stream, which is stored in the lower words.
+            if( ++counter_[0] == 0 ) {
+                ++counter_[1];
+            }
+        }
+        return buffer_[ buffer_pos_++ ];
+    }
+
+    /**
+     * @brief Skip a number of values in the stream.
+     */
+    void discard( unsigned long long n )
+    {
+        for( unsigned long long i = 0; i < n; ++i ) {
+            operator()();
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Helpers
+    // -------------------------------------------------------------------------
+
+private:
+
+    using Block = std::array<std::uint32_t, 4>;
+    using Key   = std::array<std::uint32_t, 2>;
+
+    /**
+     * @brief Compute the ten rounds of the Philox bijection of the @p counter under the @p key.
+     */
+    static Block generate_block_( Block counter, Key key )
+    {
+        // Multipliers and key schedule constants (golden ratio and sqrt(3)-1) of Philox4x32.
+        std::uint64_t const m0 = 0xD2511F53;
+        std::uint64_t const m1 = 0xCD9E8D57;
+        std::uint32_t const w0 = 0x9E3779B9;
+        std::uint32_t const w1 = 0xBB67AE85;
+
+        for( size_t r = 0; r < 10; ++r ) {
+            if( r > 0 ) {
+                key[0] += w0;
+                key[1] += w1;
+            }
+            auto const prod0 = m0 * counter[0];
+            auto const prod1 = m1 * counter[2];
+            counter = Block{{
+                static_cast<std::uint32_t>( prod1 >> 32 ) ^ counter[1] ^ key[0],
+                static_cast<std::uint32_t>( prod1 ),
+                static_cast<std::uint32_t>( prod0 >> 32 ) ^ counter[3] ^ key[1],
+                static_cast<std::uint32_t>( prod0 )
+            }};
+        }
+        return counter;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Data Members
+    // -------------------------------------------------------------------------
+
+    Block counter_;
+    Key   key_;
+
+    Block  buffer_     = {{ 0, 0, 0, 0 }};
+    size_t buffer_pos_ = 4;
+
+};
+
+// =================================================================================================
+//      Hypergeometric Distribution
+// =================================================================================================
+
+/**
+ * @brief Get a uniform random value in the open interval `(0, 1)`, with 53 bits of randomness
+ * from two values of the @p engine.
+ */
+template<class Engine>
+inline double uniform_open_unit( Engine& engine )
+{
+    auto const a = static_cast<std::uint32_t>( engine() ) >> 5;
+    auto const b = static_cast<std::uint32_t>( engine() ) >> 6;
+    return ( static_cast<double>( a ) * 67108864.0 + static_cast<double>( b ) + 0.5 )
+        / 9007199254740992.0;
+}
+
+/**
+ * @brief Compute `log( n! )`, using the Stirling series, with the recursion of the gamma
+ * function for small values.
+ *
+ * Unlike `std::lgamma`, this does not write to the global `signgam`, and so can be used
+ * from several threads.
+ */
+inline double log_factorial( double n )
+{
+    static const std::array<double, 10> a = {{
+        8.333333333333333e-02, -2.777777777777778e-03, 7.936507936507937e-04,
+        -5.952380952380952e-04, 8.417508417508418e-04, -1.917526917526918e-03,
+        6.410256410256410e-03, -2.955065359477124e-02, 1.796443723688307e-01,
+        -1.39243221690590e+00
+    }};
+
+    // We need the log gamma of x = n + 1, which for small x we shift up to 7 first.
+    auto const x = n + 1.0;
+    if( x == 1.0 || x == 2.0 ) {
+        return 0.0;
+    }
+    auto const shift = ( x < 7.0 ) ? static_cast<size_t>( 7.0 - x ) : 0;
+    auto x0 = x + static_cast<double>( shift );
+    auto const x2 = 1.0 / ( x0 * x0 );
+    auto series = a[9];
+    for( size_t k = 9; k > 0; --k ) {
+        series = series * x2 + a[k - 1];
+    }
+    auto result = series / x0 + 0.9189385332046727 + ( x0 - 0.5 ) * std::log( x0 ) - x0;
+    for( size_t k = 0; k < shift; ++k ) {
+        x0 -= 1.0;
+        result -= std::log( x0 );
+    }
+    return result;
+}
+
+/**
+ * @brief Draw the number of @p good items in a sample of size @p sample, drawn without
+ * replacement from @p good and @p bad items, that is, a hypergeometric random variate.
+ *
+ * By symmetry, we draw the count of the rarer kind of items in the smaller one of the sample
+ * and its complement. If that sample is small, we use inversion, starting at zero, which needs
+ * a single uniform value. Otherwise, we use the ratio-of-uniforms method HRUA of Stadlober,
+ * "The ratio of uniforms approach for generating discrete random variates", J. Comput. Appl.
+ * Math. 31 (1990), as implemented in NumPy, which needs a constant expected number of uniform
+ * values, independent of the counts.
+ */
+template<class Engine>
+inline size_t hypergeometric_variate( Engine& engine, size_t good, size_t bad, size_t sample )
+{
+    assert( sample <= good + bad );
+    if( good == 0 || sample == 0 ) {
+        return 0;
+    }
+    if( bad == 0 ) {
+        return sample;
+    }
+
+    auto const total = good + bad;
+    auto const rare  = std::min( good, bad );
+    auto const other = std::max( good, bad );
+    auto const m     = std::min( sample, total - sample );
+
+    size_t z = 0;
+    if( m < 10 ) {
+        // Inversion, with the recursion of the probabilities p(k+1) / p(k).
+        // As m <= total / 2 and rare <= total / 2, the lowest possible value is zero.
+        double p = 1.0;
+        for( size_t i = 0; i < m; ++i ) {
+            p *= static_cast<double>( other - i ) / static_cast<double>( total - i );
+        }
+        auto u = uniform_open_unit( engine );
+        auto const z_max = std::min( m, rare );
+        while( u > p && z < z_max ) {
+            u -= p;
+            p *= static_cast<double>(( rare - z ) * ( m - z ));
+            p /= static_cast<double>(( z + 1 ) * ( other - m + z + 1 ));
+            ++z;
+        }
+    } else {
+        // Ratio of uniforms, with the constants of the hat function.
+        double const d1 = 1.7155277699214135;
+        double const d2 = 0.8989161620588988;
+        auto const n_total = static_cast<double>( total );
+        auto const n_rare  = static_cast<double>( rare );
+        auto const n_other = static_cast<double>( other );
+        auto const n_m     = static_cast<double>( m );
+
+        auto const d4 = n_rare / n_total;
+        auto const d5 = 1.0 - d4;
+        auto const d6 = n_m * d4 + 0.5;
+        auto const d7 = std::sqrt(
+            ( n_total - n_m ) * static_cast<double>( sample ) * d4 * d5 / ( n_total - 1.0 ) + 0.5
+        );
+        auto const d8 = d1 * d7 + d2;
+        auto const d9 = std::floor(( n_m + 1.0 ) * ( n_rare + 1.0 ) / ( n_total + 2.0 ));
+        auto const d10 = log_factorial( d9 ) + log_factorial( n_rare - d9 ) +
+            log_factorial( n_m - d9 ) + log_factorial( n_other - n_m + d9 );
+        auto const d11 = std::min( std::min( n_m, n_rare ) + 1.0, std::floor( d6 + 16.0 * d7 ));
+
+        while( true ) {
+            auto const x = uniform_open_unit( engine );
+            auto const y = uniform_open_unit( engine );
+            auto const w = d6 + d8 * ( y - 0.5 ) / x;
+
+            // Fast rejection outside of the support.
+            if( w < 0.0 || w >= d11 ) {
+                continue;
+            }
+
+            auto const k = std::floor( w );
+            auto const t = d10 - (
+                log_factorial( k ) + log_factorial( n_rare - k ) +
+                log_factorial( n_m - k ) + log_factorial( n_other - n_m + k )
+            );
+
+            // Fast acceptance and rejection with the squeeze, and the exact test otherwise.
+            if( x * ( 4.0 - x ) - 3.0 <= t ) {
+                z = static_cast<size_t>( k );
+                break;
+            }
+            if( x * ( x - t ) >= 1.0 ) {
+                continue;
+            }
+            if( 2.0 * std::log( x ) <= t ) {
+                z = static_cast<size_t>( k );
+                break;
+            }
+        }
+    }
+
+    // Undo the symmetries: from the rare items to the good ones,
+    // and from the complement of the sample to the sample.
+    if( good > bad ) {
+        z = m - z;
+    }
+    if( m < sample ) {
+        z = good - z;
+    }
+    return z;
+}
+
+#endif // include guard
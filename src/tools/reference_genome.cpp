@@ -0,0 +1,110 @@
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/reference_genome.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/io/input_stream.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+
+// =================================================================================================
+//      Constructor and Rule of Five
+// =================================================================================================
+
+ReferenceGenome::ReferenceGenome( std::string const& file )
+    : file_( file )
+{
+    using namespace genesis::utils;
+
+    // Read the index. Each line has the columns name, length, offset, line bases, line width.
+    auto const fai_file = file + ".fai";
+    if( ! file_exists( fai_file )) {
+        throw std::runtime_error(
+            "Reference genome file " + file + " does not have an index file " + fai_file +
+            ". Please create it with `samtools faidx`."
+        );
+    }
+    std::string line;
+    size_t line_num = 0;
+    InputStream input( from_file( fai_file ));
+    while( input ) {
+        line.clear();
+        input.get_line( line );
+        ++line_num;
+        if( line.empty() ) {
+            continue;
+        }
+
+        auto const fields = split( line, "\t", false );
+        if( fields.size() < 5 ) {
+            throw std::runtime_error(
+                "Invalid fai index file " + fai_file + " in line " + std::to_string( line_num )
+            );
+        }
+        Sequence sequence;
+        sequence.name = fields[0];
+        try {
+            sequence.length     = std::stoull( fields[1] );
+            sequence.offset     = std::stoull( fields[2] );
+            sequence.line_bases = std::stoull( fields[3] );
+            sequence.line_width = std::stoull( fields[4] );
+        } catch( ... ) {
+            throw std::runtime_error(
+                "Invalid fai index file " + fai_file + " in line " + std::to_string( line_num )
+            );
+        }
+        if( sequence.line_bases == 0 || sequence.line_width < sequence.line_bases ) {
+            throw std::runtime_error(
+                "Invalid fai index file " + fai_file + " in line " + std::to_string( line_num )
+            );
+        }
+        if( index_.count( sequence.name ) > 0 ) {
+            throw std::runtime_error(
+                "Invalid fai index file " + fai_file + " with duplicate sequence " + sequence.name
+            );
+        }
+        index_[ sequence.name ] = sequences_.size();
+        sequences_.push_back( sequence );
+    }
+
+    // Check that the index fits the file, so that we do not need to check this on every access.
+    // This also catches compressed files, which cannot be used here.
+    for( auto const& sequence : sequences_ ) {
+        if( sequence.length == 0 ) {
+            continue;
+        }
+        auto const last = sequence.length - 1;
+        auto const end = sequence.offset + ( last / sequence.line_bases ) * sequence.line_width
+                       + ( last % sequence.line_bases );
+        if( end >= file_.size() ) {
+            throw std::runtime_error(
+                "Reference genome file " + file + " does not match its index file " + fai_file +
+                " for sequence " + sequence.name + ". Note that the file cannot be compressed."
+            );
+        }
+    }
+}
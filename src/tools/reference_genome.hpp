@@ -0,0 +1,156 @@
+#ifndef GRENEDALF_TOOLS_REFERENCE_GENOME_H_
+#define GRENEDALF_TOOLS_REFERENCE_GENOME_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/mapped_file.hpp"
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// =================================================================================================
+//      Reference Genome
+// =================================================================================================
+
+/**
+ * @brief Random access to the bases of a FASTA reference genome, using its `.fai` index.
+ *
+ * The FASTA file is memory-mapped, and its `.fai` index (as produced by `samtools faidx`) is used
+ * to compute the location of each base in the file, so that a lookup is O(1). Only the index is
+ * read when opening the file; the sequence data is loaded lazily by the operating system
+ * as it is accessed, so that only the chromosomes that are actually used are ever read.
+ *
+ * The file has to be uncompressed for this to work. Positions are 1-based, as in the rest of
+ * grenedalf. The class is not copyable, as it owns the mapping of the file.
+ */
+class ReferenceGenome
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Typedefs
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Entry of the `.fai` index for one sequence (chromosome) of the file.
+     */
+    struct Sequence
+    {
+        std::string name;
+        size_t length;
+        size_t offset;
+        size_t line_bases;
+        size_t line_width;
+    };
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Open a FASTA @p file, using the index file with the same name plus `.fai`.
+     */
+    explicit ReferenceGenome( std::string const& file );
+    ~ReferenceGenome() = default;
+
+    ReferenceGenome( ReferenceGenome const& other ) = delete;
+    ReferenceGenome( ReferenceGenome&& )            = delete;
+
+    ReferenceGenome& operator= ( ReferenceGenome const& other ) = delete;
+    ReferenceGenome& operator= ( ReferenceGenome&& )            = delete;
+
+    // -------------------------------------------------------------------------
+    //     Accessors
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Get the index entry of a @p chromosome, or `nullptr` if it is not in the file.
+     *
+     * This allows to look up many positions on the same chromosome without finding it by name.
+     */
+    Sequence const* get_sequence( std::string const& chromosome ) const
+    {
+        auto const it = index_.find( chromosome );
+        return it == index_.end() ? nullptr : &sequences_[ it->second ];
+    }
+
+    /**
+     * @brief Get the length of a @p chromosome, or 0 if it is not in the file.
+     */
+    size_t chromosome_length( std::string const& chromosome ) const
+    {
+        auto const sequence = get_sequence( chromosome );
+        return sequence ? sequence->length : 0;
+    }
+
+    /**
+     * @brief Get the upper case base at a 1-based @p position of a @p sequence.
+     *
+     * Positions outside of the sequence yield `N`.
+     */
+    char get_base( Sequence const& sequence, size_t position ) const
+    {
+        if( position == 0 || position > sequence.length ) {
+            return 'N';
+        }
+        auto const index = position - 1;
+        auto const offset = sequence.offset + ( index / sequence.line_bases ) * sequence.line_width
+                          + ( index % sequence.line_bases );
+        auto const c = file_.data()[ offset ];
+        return ( c >= 'a' && c <= 'z' ) ? static_cast<char>( c - 'a' + 'A' ) : c;
+    }
+
+    /**
+     * @brief Get the upper case base at a 1-based @p position of a @p chromosome.
+     *
+     * Unknown chromosomes and positions outside of the chromosome yield `N`.
+     */
+    char get_base( std::string const& chromosome, size_t position ) const
+    {
+        auto const sequence = get_sequence( chromosome );
+        return sequence ? get_base( *sequence, position ) : 'N';
+    }
+
+    std::vector<Sequence> const& sequences() const
+    {
+        return sequences_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Data Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    std::vector<Sequence> sequences_;
+    std::unordered_map<std::string, size_t> index_;
+
+    // Memory mapping of the FASTA file.
+    MappedFile file_;
+
+};
+
+#endif // include guard
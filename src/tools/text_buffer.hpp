@@ -0,0 +1,73 @@
+#ifndef GRENEDALF_TOOLS_TEXT_BUFFER_H_
+#define GRENEDALF_TOOLS_TEXT_BUFFER_H_
+
+/*
+    grenedalf - Genome Analyses of Differential Allele Frequencies
+    Copyright (C) 2020-2021 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// =================================================================================================
+//      Text Buffer Helpers
+// =================================================================================================
+
+/**
+ * @brief Append the decimal text representation of an unsigned number to a @p buffer.
+ *
+ * This is a fast path for the frequent case of writing counts and positions, which avoids the
+ * overhead of formatting via streams. Appending to a buffer that is re-used for many lines,
+ * and then writing the whole buffer at once, keeps allocations and stream calls to a minimum.
+ */
+inline void append_unsigned( std::string& buffer, std::uint64_t value )
+{
+    // Write the digits back to front into a local array, which fits the largest 64 bit number.
+    std::array<char, 20> digits;
+    size_t pos = digits.size();
+    do {
+        digits[ --pos ] = static_cast<char>( '0' + ( value % 10 ));
+        value /= 10;
+    } while( value > 0 );
+    buffer.append( digits.data() + pos, digits.size() - pos );
+}
+
+/**
+ * @brief Append the text representation of a floating point number to a @p buffer.
+ *
+ * This uses the same format as the default of `std::ostream`, that is, `%g` with six significant
+ * digits, so that the output is identical to writing the value to a stream.
+ */
+inline void append_double( std::string& buffer, double value )
+{
+    // The longest output of %g with the default precision is something like -1.23457e-308,
+    // so our local array is plenty.
+    std::array<char, 32> chars;
+    auto const len = std::snprintf( chars.data(), chars.size(), "%g", value );
+    if( len > 0 ) {
+        buffer.append( chars.data(), static_cast<size_t>( len ));
+    }
+}
+
+#endif // include guard